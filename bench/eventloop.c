@@ -0,0 +1,47 @@
+#include <glib.h>
+
+#include "eventloop.h"
+
+#define PURPLE_GLIB_READ_COND  (G_IO_IN | G_IO_HUP | G_IO_ERR)
+#define PURPLE_GLIB_WRITE_COND (G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL)
+
+struct io_closure {
+	PurpleInputFunction function;
+	gpointer data;
+};
+
+static gboolean io_invoke(GIOChannel *source, GIOCondition condition, gpointer data) {
+	struct io_closure *closure = data;
+	PurpleInputCondition cond = 0;
+	if (condition & PURPLE_GLIB_READ_COND)
+		cond |= PURPLE_INPUT_READ;
+	if (condition & PURPLE_GLIB_WRITE_COND)
+		cond |= PURPLE_INPUT_WRITE;
+	closure->function(closure->data, g_io_channel_unix_get_fd(source), cond);
+	return TRUE;
+}
+
+static guint io_add(gint fd, PurpleInputCondition condition, PurpleInputFunction function, gpointer data) {
+	struct io_closure *closure = g_new0(struct io_closure, 1);
+	closure->function = function;
+	closure->data = data;
+
+	GIOCondition cond = 0;
+	if (condition & PURPLE_INPUT_READ)
+		cond |= PURPLE_GLIB_READ_COND;
+	if (condition & PURPLE_INPUT_WRITE)
+		cond |= PURPLE_GLIB_WRITE_COND;
+
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	guint id = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, cond, io_invoke, closure, g_free);
+	g_io_channel_unref(channel);
+	return id;
+}
+
+PurpleEventLoopUiOps bench_eventloop_ops = {
+	.timeout_add = g_timeout_add,
+	.timeout_remove = g_source_remove,
+	.input_add = io_add,
+	.input_remove = g_source_remove,
+	.timeout_add_seconds = g_timeout_add_seconds,
+};
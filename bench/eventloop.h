@@ -0,0 +1,9 @@
+#ifndef _BENCH_EVENTLOOP_H
+#define _BENCH_EVENTLOOP_H
+
+#include <purple.h>
+
+/* The glib event loop, as in libpurple's nullclient example */
+extern PurpleEventLoopUiOps bench_eventloop_ops;
+
+#endif
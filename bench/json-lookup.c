@@ -0,0 +1,167 @@
+/* Time json_get_prop on API responses with and without the key index (json_enable_index),
+ * looking up what the plugin looks up in each kind of object.
+ *
+ * usage: json-lookup FILE.json ...
+ *
+ * The files are single responses, like those saved by bench/mock-slack.py --dump, or recorded from a real workspace
+ * (the "api response:" lines of the debug log). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "../slack-json.h"
+
+#define BENCH_MIN_USEC (G_USEC_PER_SEC / 4)
+
+static const char *const top_props[] = {
+	"ok", "error", "response_metadata", "members", "channels", "groups", "mpims", "ims", "messages", "self", "team", "url", NULL
+};
+/* slack_user_update, users_info_cb */
+static const char *const user_props[] = {
+	"id", "name", "deleted", "profile", "is_primary_owner", "is_owner", "is_admin", "is_ultra_restricted", "is_restricted",
+	"has_2fa", "two_factor_type", "updated", NULL
+};
+static const char *const profile_props[] = {
+	"display_name", "status_text", "current_status", "avatar_hash", "image_192",
+	"first_name", "last_name", "real_name", "email", "skype", "phone", "title", NULL
+};
+/* slack_channel_set, slack_im_set, conversation_counts_cb */
+static const char *const conversation_props[] = {
+	"id", "name", "user", "user_id", "is_im", "is_open", "is_archived", "is_mpim", "is_group", "is_member", "is_general", "is_channel",
+	"has_unreads", "unread_count", "is_muted", "last_read", NULL
+};
+/* handle_message, get_history_cb */
+static const char *const message_props[] = {
+	"type", "subtype", "ts", "thread_ts", "user", "username", "text", "hidden", "channel", "message", "previous_message",
+	"deleted_ts", "reply_count", "latest_reply", "attachments", "files", NULL
+};
+/* slack_attachment_to_html */
+static const char *const attachment_props[] = {
+	"fallback", "pretext", "author_name", "author_subname", "author_link", "title", "title_link", "text", "fields", "footer",
+	"color", "service_name", "service_link", "from_url", "ts", NULL
+};
+static const char *const none[] = { NULL };
+
+static const char *const *member_props(const char *name) {
+	if (!strcmp(name, "members"))
+		return user_props;
+	if (!strcmp(name, "profile"))
+		return profile_props;
+	if (!strcmp(name, "channels") || !strcmp(name, "groups") || !strcmp(name, "mpims") || !strcmp(name, "ims"))
+		return conversation_props;
+	if (!strcmp(name, "messages"))
+		return message_props;
+	if (!strcmp(name, "attachments"))
+		return attachment_props;
+	return none;
+}
+
+struct lookup {
+	json_value *obj;
+	const char *prop;
+};
+
+/* Collect the lookups to do in every object (elements of arrays using their array's props) */
+static void walk(json_value *val, const char *const *props, GArray *lookups) {
+	switch (val->type) {
+		case json_object:
+			for (const char *const *p = props; *p; p++) {
+				struct lookup l = { val, *p };
+				g_array_append_val(lookups, l);
+			}
+			for (unsigned i = 0; i < val->u.object.length; i++)
+				walk(val->u.object.values[i].value, member_props(val->u.object.values[i].name), lookups);
+			break;
+		case json_array:
+			for (unsigned i = 0; i < val->u.array.length; i++)
+				walk(val->u.array.values[i], props, lookups);
+			break;
+		default:
+			break;
+	}
+}
+
+static json_value *parse(const gchar *buf, gsize len, gboolean index) {
+	json_settings settings = {
+		.settings = index ? json_enable_index : 0,
+		.value_extra = sizeof(json_object_index *), /* so json_get_prop sees no index without it */
+	};
+	return json_parse_ex(&settings, buf, len, NULL);
+}
+
+struct result {
+	double parse_usec;
+	double lookup_nsec;
+	guint lookups, found;
+};
+
+static void run(const gchar *buf, gsize len, gboolean index, struct result *r) {
+	unsigned n = 0;
+	gint64 start = g_get_monotonic_time(), t;
+	do {
+		json_value_free(parse(buf, len, index));
+		n++;
+	} while ((t = g_get_monotonic_time()) - start < BENCH_MIN_USEC);
+	r->parse_usec = (double)(t - start) / n;
+
+	json_value *json = parse(buf, len, index);
+	GArray *lookups = g_array_new(FALSE, FALSE, sizeof(struct lookup));
+	walk(json, top_props, lookups);
+	const struct lookup *l = (const struct lookup *)lookups->data;
+	r->lookups = lookups->len;
+	n = 0;
+	start = g_get_monotonic_time();
+	do {
+		r->found = 0;
+		for (guint i = 0; i < lookups->len; i++)
+			if (json_get_prop(l[i].obj, l[i].prop))
+				r->found++;
+		n++;
+	} while ((t = g_get_monotonic_time()) - start < BENCH_MIN_USEC);
+	r->lookup_nsec = 1000.0 * (t - start) / n / MAX(r->lookups, 1);
+	g_array_free(lookups, TRUE);
+	json_value_free(json);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE.json ...\n", argv[0]);
+		return 2;
+	}
+
+	printf("%-28s %9s %9s %9s %14s %14s\n", "", "bytes", "lookups", "found", "linear", "indexed");
+	for (int i = 1; i < argc; i++) {
+		gchar *buf;
+		gsize len;
+		GError *err = NULL;
+		if (!g_file_get_contents(argv[i], &buf, &len, &err)) {
+			fprintf(stderr, "%s\n", err->message);
+			return 1;
+		}
+		json_value *json = parse(buf, len, FALSE);
+		if (!json) {
+			fprintf(stderr, "%s: invalid json\n", argv[i]);
+			return 1;
+		}
+		json_value_free(json);
+
+		struct result linear, indexed;
+		run(buf, len, FALSE, &linear);
+		run(buf, len, TRUE, &indexed);
+		if (linear.found != indexed.found) {
+			fprintf(stderr, "%s: indexed lookups found %u, linear %u\n", argv[i], indexed.found, linear.found);
+			return 1;
+		}
+
+		char *name = g_path_get_basename(argv[i]);
+		printf("%-28s %9" G_GSIZE_FORMAT " %9u %9u %11.1f ns %11.1f ns   (parse %+.0f%%)\n",
+				name, len, linear.lookups, linear.found, linear.lookup_nsec, indexed.lookup_nsec,
+				100 * (indexed.parse_usec / linear.parse_usec - 1));
+		g_free(name);
+		g_free(buf);
+	}
+	return 0;
+}
@@ -0,0 +1,67 @@
+/* Time parsing API responses, both plainly (json_parse) and as the plugin does (slack_json_parse, with the arena and key
+ * index), in MB/s.
+ *
+ * usage: json-parse FILE.json ...
+ *
+ * The Makefile also builds json-parse-portable, with json.c's portable scan_string in place of the SSE2 one. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "../slack-json.h"
+
+#define BENCH_MIN_USEC (G_USEC_PER_SEC / 2)
+
+/* MB/s parsing buf with parse/release */
+#define TIME_PARSE(PARSE, RELEASE) ({ \
+		unsigned _n = 0; \
+		gint64 _start = g_get_monotonic_time(), _t; \
+		do { \
+			RELEASE(PARSE(buf, len)); \
+			_n++; \
+		} while ((_t = g_get_monotonic_time()) - _start < BENCH_MIN_USEC); \
+		(double)len * _n / (_t - _start); \
+	})
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE.json ...\n", argv[0]);
+		return 2;
+	}
+
+	printf("%-28s %9s %12s %12s\n", "", "bytes", "json_parse", "slack_json");
+	gsize total = 0;
+	double plain_usec = 0, slack_usec = 0;
+	for (int i = 1; i < argc; i++) {
+		gchar *buf;
+		gsize len;
+		GError *err = NULL;
+		if (!g_file_get_contents(argv[i], &buf, &len, &err)) {
+			fprintf(stderr, "%s\n", err->message);
+			return 1;
+		}
+		json_value *json = json_parse(buf, len);
+		if (!json) {
+			fprintf(stderr, "%s: invalid json\n", argv[i]);
+			return 1;
+		}
+		json_value_free(json);
+
+		double plain = TIME_PARSE(json_parse, json_value_free);
+		double slack = TIME_PARSE(slack_json_parse, slack_json_free);
+		total += len;
+		plain_usec += len / plain;
+		slack_usec += len / slack;
+
+		char *name = g_path_get_basename(argv[i]);
+		printf("%-28s %9" G_GSIZE_FORMAT " %7.0f MB/s %7.0f MB/s\n", name, len, plain, slack);
+		g_free(name);
+		g_free(buf);
+	}
+	if (argc > 2)
+		printf("%-28s %9" G_GSIZE_FORMAT " %7.0f MB/s %7.0f MB/s\n", "(all)", total, total / plain_usec, total / slack_usec);
+	return 0;
+}
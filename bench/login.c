@@ -0,0 +1,127 @@
+/* A headless libpurple client that logs one slack account in (normally against bench/mock-slack.py, which runs it)
+ * and reports how long it took to get to PURPLE_CONNECTED and how much memory it used.
+ *
+ * usage: login PLUGIN_DIR API_URL USER_DIR LINGER [OPTION=VALUE ...]
+ *
+ * Prints "connected=SECONDS rss_kb=KB" once connected, and then, after staying connected for LINGER seconds, "rss_kb=KB"
+ * again for the peak overall.  The account options are set as bool, int, or string depending on how they look. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <purple.h>
+
+#include "eventloop.h"
+
+#define SLACK_PLUGIN_ID "prpl-slack" /* as in slack.h */
+
+#define UI_ID "slack-bench"
+#define LOGIN_TIMEOUT 120
+
+static PurpleCoreUiOps core_ops;
+
+static GMainLoop *loop;
+static gint64 start;
+static double linger;
+static int status = 1;
+
+static long peak_rss_kb(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static gboolean quit_cb(gpointer data) {
+	g_main_loop_quit(loop);
+	return FALSE;
+}
+
+static void signed_on_cb(PurpleConnection *gc, gpointer data) {
+	printf("connected=%.3f rss_kb=%ld\n", (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC, peak_rss_kb());
+	fflush(stdout);
+	status = 0;
+	g_timeout_add(linger * 1000, quit_cb, NULL);
+}
+
+static void connection_error_cb(PurpleConnection *gc, PurpleConnectionError reason, const char *desc, gpointer data) {
+	printf("error=%d %s\n", reason, desc);
+	status = 1;
+	g_main_loop_quit(loop);
+}
+
+static gboolean timeout_cb(gpointer data) {
+	if (status) {
+		printf("error=timeout\n");
+		g_main_loop_quit(loop);
+	}
+	return FALSE;
+}
+
+static void account_set(PurpleAccount *account, const char *option) {
+	char **kv = g_strsplit(option, "=", 2);
+	char *end;
+	long n;
+	if (!kv[0] || !kv[1])
+		fprintf(stderr, "ignoring option %s\n", option);
+	else if (!strcmp(kv[1], "true") || !strcmp(kv[1], "false"))
+		purple_account_set_bool(account, kv[0], !strcmp(kv[1], "true"));
+	else if ((n = strtol(kv[1], &end, 10)), *kv[1] && !*end)
+		purple_account_set_int(account, kv[0], n);
+	else
+		purple_account_set_string(account, kv[0], kv[1]);
+	g_strfreev(kv);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 5) {
+		fprintf(stderr, "usage: %s PLUGIN_DIR API_URL USER_DIR LINGER [OPTION=VALUE ...]\n", argv[0]);
+		return 2;
+	}
+	linger = g_ascii_strtod(argv[4], NULL);
+
+	loop = g_main_loop_new(NULL, FALSE);
+	purple_util_set_user_dir(argv[3]);
+	purple_debug_set_enabled(getenv("SLACK_BENCH_DEBUG") != NULL);
+	purple_core_set_ui_ops(&core_ops);
+	purple_eventloop_set_ui_ops(&bench_eventloop_ops);
+	purple_plugins_add_search_path(argv[1]);
+	if (!purple_core_init(UI_ID)) {
+		fprintf(stderr, "libpurple initialization failed\n");
+		return 1;
+	}
+	purple_set_blist(purple_blist_new());
+	purple_blist_load();
+
+	if (!purple_find_prpl(SLACK_PLUGIN_ID)) {
+		fprintf(stderr, "%s not found in %s\n", SLACK_PLUGIN_ID, argv[1]);
+		return 1;
+	}
+
+	static int handle;
+	purple_signal_connect(purple_connections_get_handle(), "signed-on", &handle, PURPLE_CALLBACK(signed_on_cb), NULL);
+	purple_signal_connect(purple_connections_get_handle(), "connection-error", &handle, PURPLE_CALLBACK(connection_error_cb), NULL);
+
+	PurpleAccount *account = purple_accounts_find("bench%bench.invalid", SLACK_PLUGIN_ID);
+	if (!account) {
+		account = purple_account_new("bench%bench.invalid", SLACK_PLUGIN_ID);
+		purple_accounts_add(account);
+	}
+	purple_account_set_password(account, "xoxc-bench");
+	purple_account_set_string(account, "api_url", argv[2]);
+	for (int i = 5; i < argc; i++)
+		account_set(account, argv[i]);
+
+	start = g_get_monotonic_time();
+	purple_account_set_enabled(account, UI_ID, TRUE);
+	g_timeout_add_seconds(LOGIN_TIMEOUT, timeout_cb, NULL);
+	g_main_loop_run(loop);
+
+	/* disconnecting saves the snapshot for the next run */
+	purple_account_set_enabled(account, UI_ID, FALSE);
+	purple_core_quit();
+	printf("rss_kb=%ld\n", peak_rss_kb());
+	return status;
+}
@@ -0,0 +1,515 @@
+#!/usr/bin/env python3
+"""A stand-in Slack server, for benchmarking logins without a live workspace.
+
+It serves a synthetic workspace over plain http (the plugin's api_url setting points it here) for the Web API methods the
+plugin uses, and the RTM websocket, which sends hello and then a steady stream of messages.
+
+With --dump, it saves sample responses, as a corpus for the JSON benchmarks.
+With --driver, it runs the headless client (bench/login.c) against itself, first without and then with the directory
+snapshot, and reports time to connected, peak RSS, and API calls.  Otherwise it just serves until interrupted.
+"""
+
+import argparse
+import asyncio
+import base64
+import collections
+import gzip
+import hashlib
+import json
+import os
+import random
+import re
+import shutil
+import sys
+import tempfile
+import time
+import zlib
+
+ALNUM = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+WS_GUID = b"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+def encode(value):
+    """Like Slack's JSON: compact, raw UTF-8, and escaped slashes"""
+    return json.dumps(value, ensure_ascii=False, separators=(",", ":")).replace("/", "\\/").encode()
+
+
+def object_id(prefix, n):
+    digits = ""
+    while n or len(digits) < 8:
+        n, d = divmod(n, 36)
+        digits = ALNUM[d] + digits
+    return prefix + digits
+
+
+class Workspace:
+    """Users, channels, and IMs in roughly the shape (and size) the real API returns them"""
+
+    def __init__(self, users, channels, ims, seed):
+        rnd = random.Random(seed)
+        self.rnd = rnd
+        self.team = {"id": "T0BENCH00", "name": "Bench", "domain": "bench"}
+        now = int(time.time())
+
+        self.users = []
+        for i in range(max(users, 1)):
+            name = "user%d" % i
+            self.users.append({
+                "id": object_id("U", i),
+                "team_id": self.team["id"],
+                "name": name,
+                "deleted": rnd.random() < 0.05,
+                "color": "%06x" % rnd.getrandbits(24),
+                "real_name": "User %d" % i,
+                "tz": "America/New_York",
+                "tz_label": "Eastern Daylight Time",
+                "tz_offset": -14400,
+                "profile": {
+                    "title": rnd.choice(["", "Engineer", "Manager", "Designer"]),
+                    "phone": "",
+                    "skype": "",
+                    "real_name": "User %d" % i,
+                    "real_name_normalized": "User %d" % i,
+                    "display_name": name if rnd.random() < 0.7 else "",
+                    "display_name_normalized": name,
+                    "status_text": rnd.choice(["", "", "In a meeting", "On vacation"]),
+                    "status_emoji": "",
+                    "status_expiration": 0,
+                    "avatar_hash": "%012x" % rnd.getrandbits(48),
+                    "email": "%s@bench.invalid" % name,
+                    "first_name": "User",
+                    "last_name": str(i),
+                    "image_24": "https://avatars.invalid/%d_24.png" % i,
+                    "image_48": "https://avatars.invalid/%d_48.png" % i,
+                    "image_72": "https://avatars.invalid/%d_72.png" % i,
+                    "image_192": "https://avatars.invalid/%d_192.png" % i,
+                    "image_512": "https://avatars.invalid/%d_512.png" % i,
+                    "team": self.team["id"],
+                },
+                "is_admin": i == 0,
+                "is_owner": i == 0,
+                "is_primary_owner": i == 0,
+                "is_restricted": False,
+                "is_ultra_restricted": False,
+                "is_bot": False,
+                "is_app_user": False,
+                "updated": now - rnd.randrange(10**7),
+                "has_2fa": rnd.random() < 0.5,
+            })
+        self.self = self.users[0]
+
+        self.channels = []
+        for i in range(channels):
+            kind = rnd.random()
+            if kind < 0.7:
+                chan = {"id": object_id("C", i), "is_channel": True, "is_group": False, "is_mpim": False, "is_private": False}
+            elif kind < 0.9:
+                chan = {"id": object_id("G", i), "is_channel": False, "is_group": True, "is_mpim": False, "is_private": True}
+            else:
+                chan = {"id": object_id("G", i), "is_channel": False, "is_group": False, "is_mpim": True, "is_private": True}
+            chan.update({
+                "name": "channel-%d" % i,
+                "name_normalized": "channel-%d" % i,
+                "created": now - rnd.randrange(10**8),
+                "creator": rnd.choice(self.users)["id"],
+                "is_archived": False,
+                "is_general": i == 0,
+                "is_shared": False,
+                "is_org_shared": False,
+                "is_member": i == 0 or not chan["is_channel"] or rnd.random() < 0.3,
+                "is_im": False,
+                "topic": {"value": "Topic of channel %d" % i, "creator": rnd.choice(self.users)["id"], "last_set": now - rnd.randrange(10**6)},
+                "purpose": {"value": "Purpose of channel %d" % i, "creator": rnd.choice(self.users)["id"], "last_set": now - rnd.randrange(10**6)},
+                "num_members": rnd.randrange(2, max(users, 3)),
+            })
+            self.channels.append(chan)
+
+        self.ims = []
+        for i in range(min(ims, len(self.users) - 1)):
+            self.ims.append({
+                "id": object_id("D", i),
+                "created": now - rnd.randrange(10**8),
+                "is_im": True,
+                "is_org_shared": False,
+                "user": self.users[i + 1]["id"],
+                "is_user_deleted": self.users[i + 1]["deleted"],
+                "is_open": rnd.random() < 0.5,
+                "priority": 0,
+            })
+
+        self.joined = [c for c in self.channels if c["is_member"]] + self.ims
+        self.ts = now
+
+    def next_ts(self):
+        self.ts += 0.000001
+        return "%.6f" % self.ts
+
+    def text(self, words):
+        return " ".join(self.rnd.choice(["lorem", "ipsum", "dolor", "sit", "amet", "<@%s>" % self.self["id"], "*bold*", "`code`",
+                                         "<https://example.invalid/some/path|a link>", "caf\u00e9", "\u2713"])
+                        for _ in range(self.rnd.randrange(1, words)))
+
+    def message(self, conv=None, rich=False):
+        """A message event, or with rich, one as history returns them, with blocks and sometimes attachments"""
+        conv = conv or self.rnd.choice(self.joined or [{"id": "C00000000"}])
+        user = self.rnd.choice(self.users)["id"]
+        msg = {
+            "type": "message",
+            "channel": conv["id"],
+            "user": user,
+            "text": self.text(60),
+            "ts": self.next_ts(),
+            "team": self.team["id"],
+        }
+        if rich:
+            del msg["channel"]
+            msg["client_msg_id"] = "%08x-%04x-%04x-%04x-%012x" % tuple(self.rnd.getrandbits(b) for b in (32, 16, 16, 16, 48))
+            msg["blocks"] = [{"type": "rich_text", "block_id": "%05x" % self.rnd.getrandbits(20), "elements": [
+                {"type": "rich_text_section", "elements": [{"type": "text", "text": msg["text"]}]}]}]
+            if self.rnd.random() < 0.2:
+                msg["attachments"] = [{
+                    "id": 1,
+                    "fallback": self.text(10),
+                    "color": "36a64f",
+                    "pretext": self.text(10),
+                    "author_name": "Author",
+                    "author_link": "https://example.invalid/author",
+                    "title": self.text(8),
+                    "title_link": "https://example.invalid/title",
+                    "text": self.text(200),
+                    "fields": [{"title": "Priority", "value": "High", "short": True}],
+                    "footer": "Bench",
+                    "ts": int(self.ts),
+                }]
+            if self.rnd.random() < 0.1:
+                msg.update(thread_ts=msg["ts"], reply_count=self.rnd.randrange(1, 10), latest_reply=self.next_ts(),
+                           reply_users=[user], reply_users_count=1, subscribed=False)
+        return msg
+
+    def conversation(self, cid):
+        for conv in self.channels + self.ims:
+            if conv["id"] == cid:
+                return conv
+        return None
+
+
+def page(items, params, key):
+    start = int(params.get("cursor") or 0)
+    limit = int(params.get("limit") or 100)
+    end = start + limit
+    return {"ok": True, key: items[start:end], "response_metadata": {"next_cursor": str(end) if end < len(items) else ""}}
+
+
+class RTMConnection:
+    def __init__(self, writer):
+        self.writer = writer
+        self.deflate = None
+
+
+class MockSlack:
+    def __init__(self, workspace, args):
+        self.ws = workspace
+        self.args = args
+        self.url = None
+        self.calls = collections.Counter()
+        self.rtm_events = 0
+        self.connections = 0
+        self.sockets = set()
+
+    def reset(self):
+        self.calls.clear()
+        self.rtm_events = 0
+        self.connections = 0
+
+    # Web API
+
+    def api(self, method, params):
+        ws = self.ws
+        if method == "rtm.connect":
+            return {"ok": True, "url": self.url.replace("http://", "ws://", 1) + "/websocket/bench",
+                    "team": ws.team, "self": {"id": ws.self["id"], "name": ws.self["name"]}}
+        if method == "users.list":
+            return page(ws.users, params, "members")
+        if method == "conversations.list":
+            types = params.get("types", "public_channel").split(",")
+            convs = [c for c in ws.channels if
+                     ("public_channel" in types and c["is_channel"]) or
+                     ("private_channel" in types and c["is_group"]) or
+                     ("mpim" in types and c["is_mpim"])]
+            if "im" in types:
+                convs += ws.ims
+            return page(convs, params, "channels")
+        if method == "users.counts":
+            def counts(c):
+                unread = ws.rnd.randrange(3) == 0
+                return {"id": c["id"], "name": c.get("name"), "is_member": True, "is_muted": False,
+                        "has_unreads": unread, "unread_count": ws.rnd.randrange(1, 20) if unread else 0,
+                        "mention_count": 0, "last_read": "%.6f" % (ws.ts - 86400)}
+            joined = [c for c in ws.channels if c["is_member"]]
+            return {"ok": True,
+                    "channels": [counts(c) for c in joined if c["is_channel"]],
+                    "groups": [counts(c) for c in joined if c["is_group"]],
+                    "mpims": [counts(c) for c in joined if c["is_mpim"]],
+                    "ims": [dict(counts(c), user_id=c["user"], is_open=c["is_open"]) for c in ws.ims]}
+        if method in ("conversations.history", "conversations.replies"):
+            conv = ws.conversation(params.get("channel")) or {"id": params.get("channel")}
+            count = min(int(params.get("limit") or 100), self.args.history)
+            return {"ok": True, "messages": [ws.message(conv, True) for _ in range(count)], "has_more": False}
+        if method == "conversations.info":
+            conv = ws.conversation(params.get("channel"))
+            if not conv:
+                return {"ok": False, "error": "channel_not_found"}
+            return {"ok": True, "channel": dict(conv, last_read="%.6f" % (ws.ts - 86400), unread_count=0)}
+        if method == "conversations.members":
+            members = [u["id"] for u in ws.users[:self.args.members]]
+            return page(members, params, "members")
+        if method == "users.info":
+            for u in ws.users:
+                if u["id"] == params.get("user"):
+                    return {"ok": True, "user": u}
+            return {"ok": False, "error": "user_not_found"}
+        if method == "chat.postMessage":
+            conv = ws.conversation(params.get("channel")) or {"id": params.get("channel")}
+            msg = dict(ws.message(conv), user=ws.self["id"], text=params.get("text", ""))
+            self.broadcast(msg)
+            return {"ok": True, "channel": conv["id"], "ts": msg["ts"], "message": msg}
+        if method in ("conversations.mark", "users.setPresence", "users.profile.set", "chat.update", "chat.delete",
+                      "conversations.setTopic", "conversations.join", "conversations.invite", "conversations.open"):
+            return {"ok": True}
+        return {"ok": False, "error": "unknown_method"}
+
+    async def http(self, reader, writer):
+        self.connections += 1
+        self.sockets.add(writer)
+        try:
+            while True:
+                line = await reader.readline()
+                if not line:
+                    break
+                target = line.split()[1].decode()
+                headers = {}
+                while True:
+                    h = await reader.readline()
+                    if h in (b"\r\n", b"\n", b""):
+                        break
+                    k, _, v = h.decode().partition(":")
+                    headers[k.strip().lower()] = v.strip()
+                body = await reader.readexactly(int(headers.get("content-length", 0)))
+
+                if headers.get("upgrade", "").lower() == "websocket":
+                    await self.websocket(reader, writer, headers)
+                    return
+
+                method = target.rsplit("/", 1)[-1].split("?")[0]
+                params = {k.decode(): v.decode() for k, v in re.findall(rb'name="([^"]*)"\r\n\r\n(.*?)\r\n--', body, re.S)}
+                self.calls[method] += 1
+                if self.args.latency:
+                    await asyncio.sleep(self.args.latency / 1000)
+                payload = encode(self.api(method, params))
+
+                head = "HTTP/1.1 200 OK\r\nContent-Type: application/json; charset=utf-8\r\n"
+                if "gzip" in headers.get("accept-encoding", ""):
+                    payload = gzip.compress(payload, 6)
+                    head += "Content-Encoding: gzip\r\n"
+                if self.args.chunked:
+                    head += "Transfer-Encoding: chunked\r\n\r\n"
+                    payload = b"".join(b"%x\r\n%s\r\n" % (len(payload[i:i + 8192]), payload[i:i + 8192])
+                                       for i in range(0, len(payload), 8192)) + b"0\r\n\r\n"
+                else:
+                    head += "Content-Length: %d\r\n\r\n" % len(payload)
+                writer.write(head.encode() + payload)
+                await writer.drain()
+        except (ConnectionError, asyncio.IncompleteReadError, asyncio.CancelledError):
+            pass
+        finally:
+            self.sockets.discard(writer)
+            writer.close()
+
+    # RTM
+
+    @staticmethod
+    def frame(opcode, payload, rsv1=False):
+        b0 = 0x80 | (0x40 if rsv1 else 0) | opcode
+        n = len(payload)
+        if n < 126:
+            head = bytes([b0, n])
+        elif n < 65536:
+            head = bytes([b0, 126]) + n.to_bytes(2, "big")
+        else:
+            head = bytes([b0, 127]) + n.to_bytes(8, "big")
+        return head + payload
+
+    @staticmethod
+    async def read_frame(reader):
+        b0, b1 = await reader.readexactly(2)
+        n = b1 & 0x7f
+        if n == 126:
+            n = int.from_bytes(await reader.readexactly(2), "big")
+        elif n == 127:
+            n = int.from_bytes(await reader.readexactly(8), "big")
+        mask = await reader.readexactly(4) if b1 & 0x80 else b"\0\0\0\0"
+        data = await reader.readexactly(n)
+        data = bytes(b ^ mask[i & 3] for i, b in enumerate(data))
+        return b0 & 0x0f, bool(b0 & 0x40), data
+
+    def rtm_send(self, conn, event):
+        data = encode(event)
+        if conn.deflate:
+            data = conn.deflate.compress(data) + conn.deflate.flush(zlib.Z_SYNC_FLUSH)
+            conn.writer.write(self.frame(1, data[:-4], True))
+        else:
+            conn.writer.write(self.frame(1, data))
+        self.rtm_events += 1
+
+    def broadcast(self, event):
+        for conn in list(self.rtm):
+            self.rtm_send(conn, event)
+
+    async def websocket(self, reader, writer, headers):
+        accept = base64.b64encode(hashlib.sha1(headers["sec-websocket-key"].encode() + WS_GUID).digest()).decode()
+        head = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n" % accept
+        conn = RTMConnection(writer)
+        if self.args.deflate and "permessage-deflate" in headers.get("sec-websocket-extensions", ""):
+            head += "Sec-WebSocket-Extensions: permessage-deflate\r\n"
+            conn.deflate = zlib.compressobj(6, zlib.DEFLATED, -15)
+        writer.write((head + "\r\n").encode())
+        self.rtm.add(conn)
+        self.rtm_send(conn, {"type": "hello"})
+        sender = asyncio.ensure_future(self.rtm_stream(conn))
+        inflate = zlib.decompressobj(-15)
+        try:
+            while True:
+                opcode, rsv1, data = await self.read_frame(reader)
+                if rsv1:
+                    data = inflate.decompress(data + b"\0\0\xff\xff")
+                if opcode == 1:
+                    msg = json.loads(data)
+                    if "id" in msg:
+                        reply = {"ok": True, "reply_to": msg["id"]}
+                        if msg.get("type") == "message":
+                            reply.update(ts=self.ws.next_ts(), text=msg.get("text"))
+                        self.rtm_send(conn, reply)
+                elif opcode == 9:
+                    writer.write(self.frame(10, data))
+                elif opcode == 8:
+                    writer.write(self.frame(8, data[:2]))
+                    break
+        except (ConnectionError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            sender.cancel()
+            self.rtm.discard(conn)
+
+    async def rtm_stream(self, conn):
+        """Messages at args.rate per second, in bursts every 100ms"""
+        if self.args.rate <= 0:
+            return
+        due = 0.0
+        while True:
+            await asyncio.sleep(0.1)
+            due += self.args.rate / 10
+            while due >= 1:
+                due -= 1
+                self.rtm_send(conn, self.ws.message())
+            await conn.writer.drain()
+
+    async def start(self, port):
+        self.rtm = set()
+        self.server = await asyncio.start_server(self.http, "127.0.0.1", port)
+        self.url = "http://127.0.0.1:%d/api" % self.server.sockets[0].getsockname()[1]
+
+    async def stop(self):
+        for w in list(self.sockets):
+            w.close()
+        self.server.close()
+        await self.server.wait_closed()
+
+
+async def run_driver(server, args, user_dir, label):
+    server.reset()
+    cmd = [args.driver, args.plugin_dir, server.url, user_dir, str(args.linger)]
+    cmd += ["%s=%s" % s for s in args.set]
+    proc = await asyncio.create_subprocess_exec(*cmd, stdout=asyncio.subprocess.PIPE)
+    out, _ = await proc.communicate()
+    result = dict(re.findall(r"(\w+)=(\S+)", out.decode()))
+    if proc.returncode or "connected" not in result:
+        print("%s: failed (%s)" % (label, out.decode().strip() or "exit %d" % proc.returncode))
+        return False
+    calls = ", ".join("%s %d" % c for c in sorted(server.calls.items()))
+    print("%s: connected in %.3fs, peak RSS %.1f MB, %d API calls (%s) on %d connections, %d RTM events" % (
+        label, float(result["connected"]), int(result["rss_kb"]) / 1024,
+        sum(server.calls.values()), calls, server.connections, server.rtm_events))
+    return True
+
+
+def dump(server, directory):
+    """Save a response to each of the calls login makes (and a history page and an RTM message), for bench/json-*.c"""
+    os.makedirs(directory, exist_ok=True)
+    calls = [
+        ("users.list", {"limit": "500"}),
+        ("conversations.list", {"types": "public_channel,private_channel,mpim,im", "limit": "500"}),
+        ("users.counts", {}),
+        ("conversations.history", {"channel": server.ws.joined[0]["id"] if server.ws.joined else "C00000000", "limit": "1000"}),
+    ]
+    server.url = "http://127.0.0.1/api"
+    for method, params in calls:
+        with open(os.path.join(directory, method + ".json"), "wb") as f:
+            f.write(encode(server.api(method, params)))
+    with open(os.path.join(directory, "rtm.message.json"), "wb") as f:
+        f.write(encode(server.ws.message()))
+
+
+async def main(args):
+    start = time.monotonic()
+    workspace = Workspace(args.users, args.channels, args.ims, args.seed)
+    print("workspace: %d users, %d channels, %d IMs, %d messages/s (generated in %.2fs)" % (
+        len(workspace.users), len(workspace.channels), len(workspace.ims), args.rate, time.monotonic() - start))
+    if args.dump:
+        dump(MockSlack(workspace, args), args.dump)
+        print("saved responses in %s" % args.dump)
+        return 0
+
+    server = MockSlack(workspace, args)
+    await server.start(args.port)
+    try:
+        if not args.driver:
+            print("serving at %s (set the account's api_url to this)" % server.url)
+            await asyncio.Event().wait()
+
+        user_dir = tempfile.mkdtemp(prefix="slack-bench-")
+        try:
+            for run in range(args.runs):
+                # the first run has no snapshot, later ones load the one it saved
+                if not await run_driver(server, args, user_dir, "cold" if run == 0 else "snapshot"):
+                    return 1
+        finally:
+            shutil.rmtree(user_dir, ignore_errors=True)
+    finally:
+        await server.stop()
+    return 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--users", type=int, default=5000)
+    parser.add_argument("--channels", type=int, default=1000)
+    parser.add_argument("--ims", type=int, default=200)
+    parser.add_argument("--rate", type=int, default=20, help="RTM messages per second")
+    parser.add_argument("--history", type=int, default=20, help="messages per history call (at most)")
+    parser.add_argument("--members", type=int, default=50, help="members per channel")
+    parser.add_argument("--latency", type=int, default=0, help="added to each API call (ms)")
+    parser.add_argument("--chunked", action="store_true", help="send chunked API responses")
+    parser.add_argument("--no-deflate", dest="deflate", action="store_false", help="refuse RTM compression")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--port", type=int, default=0)
+    parser.add_argument("--driver", help="headless client to run (bench/login)")
+    parser.add_argument("--dump", metavar="DIR", help="just save sample responses in DIR")
+    parser.add_argument("--plugin-dir", default=".", help="directory with libslack.so")
+    parser.add_argument("--runs", type=int, default=2, help="logins to run: the first cold, the rest from its snapshot")
+    parser.add_argument("--linger", type=float, default=2, help="seconds to stay connected after login")
+    parser.add_argument("--set", action="append", default=[], type=lambda s: tuple(s.split("=", 1)),
+                        metavar="OPTION=VALUE", help="account option for the driver, e.g. connect_history=true")
+    try:
+        sys.exit(asyncio.run(main(parser.parse_args())))
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,107 @@
+/* Time looking up users, channels, and IMs by id, as they come in json (plain strings), in a SlackObjectTable against a
+ * GHashTable keyed by slack_object_id (as sa->users and the rest were), with both the original hash and
+ * slack_object_id_hash.
+ *
+ * usage: object-table [ENTRIES [LOOKUPS]]
+ *
+ * Ids are random ones of the usual form (a type letter and 8-10 of [0-9A-Z]), with 2% of other forms. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "../slack-object.h"
+
+#define ROUNDS 5 /* report the best */
+
+static unsigned lookups;
+
+/* The hash sa->users etc. used before SlackObjectTable: part of the id, weakly mixed */
+static guint original_hash(gconstpointer p) {
+	const guint *x = (const guint *)((const char *)p + 1);
+	return x[0] ^ (x[1] << 1);
+}
+
+static char *random_id(unsigned i) {
+	static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	char s[SLACK_OBJECT_ID_SIZ];
+	unsigned len = 9 + i % 3;
+	s[0] = "UCDGW"[i % 5];
+	for (unsigned k = 1; k < len; k++)
+		s[k] = digits[g_random_int_range(0, 36)];
+	s[len] = 0;
+	if (i % 50 == 7)
+		s[2] = 'a' + g_random_int_range(0, 26);
+	return g_strdup(s);
+}
+
+static SlackObject *hash_lookup(GHashTable *hash, const char *s) {
+	/* as the plugin did: ids had to be made into slack_object_ids first */
+	slack_object_id id;
+	slack_object_id_set(id, s);
+	return g_hash_table_lookup(hash, id);
+}
+
+/* Best ns per lookup of each of KEYS, checking that FOUND of them were there */
+#define TIME_LOOKUPS(KEYS, LOOKUP, FOUND) ({ \
+		double _best = G_MAXDOUBLE; \
+		for (unsigned _r = 0; _r < ROUNDS; _r++) { \
+			unsigned _found = 0; \
+			gint64 _start = g_get_monotonic_time(); \
+			for (unsigned _i = 0; _i < lookups; _i++) \
+				_found += LOOKUP(KEYS[_i]) != NULL; \
+			double _ns = 1000.0 * (g_get_monotonic_time() - _start) / lookups; \
+			if (_found != (FOUND)) \
+				g_error("found %u of %u", _found, lookups); \
+			_best = MIN(_best, _ns); \
+		} \
+		_best; \
+	})
+
+int main(int argc, char **argv) {
+	unsigned n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	if (!n || !lookups) {
+		fprintf(stderr, "usage: %s [ENTRIES [LOOKUPS]]\n", argv[0]);
+		return 2;
+	}
+	g_random_set_seed(1);
+
+	SlackObject *objs = g_new0(SlackObject, n);
+	SlackObjectTable *table = slack_object_table_new(G_STRUCT_OFFSET(SlackObject, id), FALSE);
+	GHashTable *original = g_hash_table_new(original_hash, slack_object_id_equal);
+	GHashTable *current = g_hash_table_new(slack_object_id_hash, slack_object_id_equal);
+	for (unsigned i = 0; i < n; i++) {
+		char *s = random_id(i);
+		slack_object_id_set(objs[i].id, s);
+		g_free(s);
+		if (slack_object_table_lookup(table, objs[i].id))
+			continue; /* a repeat */
+		slack_object_table_replace(table, &objs[i]);
+		g_hash_table_insert(original, objs[i].id, &objs[i]);
+		g_hash_table_insert(current, objs[i].id, &objs[i]);
+	}
+
+	/* hits in random order, and misses, as strings one after another (like in parsed json) */
+	slack_object_id *hits = g_new(slack_object_id, lookups), *misses = g_new(slack_object_id, lookups);
+	for (unsigned i = 0; i < lookups; i++) {
+		slack_object_id_copy(hits[i], objs[g_random_int_range(0, n)].id);
+		do {
+			char *s = random_id(i);
+			slack_object_id_set(misses[i], s);
+			g_free(s);
+		} while (slack_object_table_lookup(table, misses[i]));
+	}
+
+#define TABLE_LOOKUP(S)		slack_object_table_lookup(table, S)
+#define ORIGINAL_LOOKUP(S)	hash_lookup(original, S)
+#define CURRENT_LOOKUP(S)	hash_lookup(current, S)
+	printf("%u entries, %u lookups (best of %u), ns per lookup:\n", slack_object_table_size(table), lookups, ROUNDS);
+	printf("%-40s %8s %8s\n", "", "hit", "miss");
+	printf("%-40s %8.1f %8.1f\n", "GHashTable, original hash", TIME_LOOKUPS(hits, ORIGINAL_LOOKUP, lookups), TIME_LOOKUPS(misses, ORIGINAL_LOOKUP, 0));
+	printf("%-40s %8.1f %8.1f\n", "GHashTable, slack_object_id_hash", TIME_LOOKUPS(hits, CURRENT_LOOKUP, lookups), TIME_LOOKUPS(misses, CURRENT_LOOKUP, 0));
+	printf("%-40s %8.1f %8.1f\n", "SlackObjectTable", TIME_LOOKUPS(hits, TABLE_LOOKUP, lookups), TIME_LOOKUPS(misses, TABLE_LOOKUP, 0));
+	return 0;
+}
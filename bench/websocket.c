@@ -0,0 +1,259 @@
+/* Receive RTM-like messages through purple-websocket.c over loopback, from a local server thread writing them as fast as
+ * it can, and report messages/sec.
+ *
+ * usage: websocket [MESSAGES [SIZE [deflate|partial]]]
+ *
+ * deflate has the server send them compressed (permessage-deflate, without context takeover, so each is the same);
+ * partial has the client take them in pieces of at most SIZE/4 (purple_websocket_set_partial). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <purple.h>
+
+#include "eventloop.h"
+#include "../purple-websocket.h"
+
+#define UI_ID "slack-bench"
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define BATCH 256 /* messages per write */
+
+static struct {
+	int listener;
+	unsigned messages;
+	GString *message;
+	gboolean deflate;
+} server;
+
+static struct {
+	GMainLoop *loop;
+	gint64 start, end;
+	unsigned messages;
+	guint64 bytes;
+	const char *error;
+} client;
+
+static gboolean write_all(int fd, const void *buf, size_t len) {
+	while (len) {
+		ssize_t r = write(fd, buf, len);
+		if (r <= 0)
+			return FALSE;
+		buf = (const char *)buf + r;
+		len -= r;
+	}
+	return TRUE;
+}
+
+/* An RTM message event with (at least) size bytes of json */
+static GString *rtm_message(size_t size) {
+	GString *msg = g_string_new("{\"type\":\"message\",\"channel\":\"C0BENCH00\",\"user\":\"U0BENCH00\",\"text\":\"");
+	const char *tail = "\",\"ts\":\"1700000000.000100\",\"team\":\"T0BENCH00\"}";
+	static const char words[] = "lorem ipsum dolor sit amet ";
+	while (msg->len + strlen(tail) < size)
+		g_string_append_c(msg, words[msg->len % (sizeof(words)-1)]);
+	g_string_append(msg, tail);
+	return msg;
+}
+
+/* Raw deflate of msg, as one permessage-deflate message (without the final empty block) */
+static GString *deflate_message(const GString *msg) {
+	z_stream z = { 0 };
+	deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	GString *out = g_string_sized_new(deflateBound(&z, msg->len) + 8);
+	z.next_in = (Bytef *)msg->str;
+	z.avail_in = msg->len;
+	z.next_out = (Bytef *)out->str;
+	z.avail_out = out->allocated_len;
+	deflate(&z, Z_SYNC_FLUSH);
+	g_string_set_size(out, z.total_out - 4);
+	deflateEnd(&z);
+	return out;
+}
+
+static void frame_header(GString *out, guint8 header, size_t len) {
+	g_string_append_c(out, header);
+	if (len < 126)
+		g_string_append_c(out, len);
+	else if (len < 0x10000) {
+		guint16 l = GUINT16_TO_BE(len);
+		g_string_append_c(out, 126);
+		g_string_append_len(out, (const char *)&l, sizeof(l));
+	} else {
+		guint64 l = GUINT64_TO_BE(len);
+		g_string_append_c(out, 127);
+		g_string_append_len(out, (const char *)&l, sizeof(l));
+	}
+}
+
+/* Accept one connection, answer its handshake, write the messages and a close, and wait for the client's close */
+static gpointer server_thread(gpointer data) {
+	int fd = accept(server.listener, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+
+	char req[4096];
+	size_t n = 0;
+	ssize_t r;
+	while (n < sizeof(req)-1 && (r = read(fd, req + n, sizeof(req)-1 - n)) > 0) {
+		req[n += r] = 0;
+		if (strstr(req, "\r\n\r\n"))
+			break;
+	}
+	char *key = strstr(req, "Sec-WebSocket-Key: ");
+	if (!key) {
+		close(fd);
+		return NULL;
+	}
+	key += strlen("Sec-WebSocket-Key: ");
+	key[strcspn(key, "\r\n")] = 0;
+
+	GChecksum *sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+	g_checksum_update(sha1, (const guchar *)key, strlen(key));
+	g_checksum_update(sha1, (const guchar *)WS_GUID, strlen(WS_GUID));
+	guint8 digest[20];
+	gsize digest_len = sizeof(digest);
+	g_checksum_get_digest(sha1, digest, &digest_len);
+	g_checksum_free(sha1);
+	gchar *accept = g_base64_encode(digest, digest_len);
+	GString *out = g_string_new(NULL);
+	g_string_printf(out, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n%s\r\n",
+			accept, server.deflate ? "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover\r\n" : "");
+	g_free(accept);
+	gboolean ok = write_all(fd, out->str, out->len);
+
+	GString *msg = server.deflate ? deflate_message(server.message) : g_string_new_len(server.message->str, server.message->len);
+	g_string_truncate(out, 0);
+	for (unsigned i = 0; i < BATCH; i++) {
+		frame_header(out, 0x81 | (server.deflate ? 0x40 : 0), msg->len);
+		g_string_append_len(out, msg->str, msg->len);
+	}
+	for (unsigned left = server.messages; ok && left; ) {
+		unsigned b = MIN(left, BATCH);
+		ok = write_all(fd, out->str, out->len / BATCH * b);
+		left -= b;
+	}
+	g_string_free(msg, TRUE);
+	g_string_free(out, TRUE);
+
+	if (ok && write_all(fd, "\x88\x00", 2))
+		while (read(fd, req, sizeof(req)) > 0);
+	close(fd);
+	return NULL;
+}
+
+static void ws_cb(PurpleWebsocket *ws, gpointer data, PurpleWebsocketOp op, const guchar *msg, size_t len) {
+	switch (op) {
+		case PURPLE_WEBSOCKET_OPEN:
+			client.start = g_get_monotonic_time();
+			break;
+		case PURPLE_WEBSOCKET_TEXT_PARTIAL:
+			client.bytes += len;
+			break;
+		case PURPLE_WEBSOCKET_TEXT:
+			client.bytes += len;
+			client.messages++;
+			break;
+		case PURPLE_WEBSOCKET_CLOSE:
+			client.end = g_get_monotonic_time();
+			g_main_loop_quit(client.loop);
+			break;
+		case PURPLE_WEBSOCKET_ERROR:
+			client.error = g_strdup((const char *)msg);
+			g_main_loop_quit(client.loop);
+			break;
+		default:
+			break;
+	}
+}
+
+/* Remove what libpurple saved in the temporary user dir */
+static void remove_dir(const char *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	const char *name;
+	while (dir && (name = g_dir_read_name(dir))) {
+		char *file = g_build_filename(path, name, NULL);
+		g_remove(file);
+		g_free(file);
+	}
+	if (dir)
+		g_dir_close(dir);
+	g_rmdir(path);
+}
+
+int main(int argc, char **argv) {
+	server.messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	size_t size = argc > 2 ? strtoul(argv[2], NULL, 10) : 300;
+	const char *mode = argc > 3 ? argv[3] : "";
+	server.deflate = !strcmp(mode, "deflate");
+	gboolean partial = !strcmp(mode, "partial");
+	if (!server.messages || (*mode && !server.deflate && !partial)) {
+		fprintf(stderr, "usage: %s [MESSAGES [SIZE [deflate|partial]]]\n", argv[0]);
+		return 2;
+	}
+	server.message = rtm_message(size);
+
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addr_len = sizeof(addr);
+	server.listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (server.listener < 0 || bind(server.listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(server.listener, 1)
+			|| getsockname(server.listener, (struct sockaddr *)&addr, &addr_len)) {
+		perror("listen");
+		return 1;
+	}
+
+	GError *err = NULL;
+	char *user_dir = g_dir_make_tmp("slack-bench-XXXXXX", &err);
+	if (!user_dir) {
+		fprintf(stderr, "%s\n", err->message);
+		return 1;
+	}
+	purple_util_set_user_dir(user_dir);
+	purple_debug_set_enabled(getenv("SLACK_BENCH_DEBUG") != NULL);
+	purple_eventloop_set_ui_ops(&bench_eventloop_ops);
+	if (!purple_core_init(UI_ID)) {
+		fprintf(stderr, "libpurple initialization failed\n");
+		return 1;
+	}
+
+	GThread *thread = g_thread_new("server", server_thread, NULL);
+	client.loop = g_main_loop_new(NULL, FALSE);
+	char *url = g_strdup_printf("ws://127.0.0.1:%d/websocket", ntohs(addr.sin_port));
+	PurpleWebsocketDeflate deflate = { .server_no_context_takeover = TRUE };
+	PurpleWebsocket *ws = purple_websocket_connect(NULL, url, NULL, NULL, server.deflate ? &deflate : NULL, ws_cb, NULL);
+	g_free(url);
+	if (ws) {
+		if (partial)
+			purple_websocket_set_partial(ws, MAX(server.message->len / 4, 1));
+		g_main_loop_run(client.loop);
+		if (!client.error)
+			purple_websocket_abort(ws);
+	}
+	close(server.listener);
+	g_thread_join(thread);
+
+	int status = 0;
+	if (!ws || client.error) {
+		printf("error=%s\n", client.error ?: "connect");
+		status = 1;
+	} else if (client.messages != server.messages || client.bytes != (guint64)client.messages * server.message->len) {
+		printf("error=received %u messages, %" G_GUINT64_FORMAT " bytes\n", client.messages, client.bytes);
+		status = 1;
+	} else {
+		double secs = (client.end - client.start) / (double)G_USEC_PER_SEC;
+		printf("%u messages of %zu bytes%s%s: %.0f messages/s, %.0f MB/s\n", client.messages, server.message->len,
+				*mode ? ", " : "", mode, client.messages / secs, client.bytes / secs / 1e6);
+	}
+
+	purple_core_quit();
+	remove_dir(user_dir);
+	g_free(user_dir);
+	return status;
+}
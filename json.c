@@ -47,6 +47,12 @@
    #include <stdint.h>
 #endif
 
+/* JSON_SCAN_PORTABLE forces the word-at-a-time scan_string (for comparison) */
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(JSON_SCAN_PORTABLE)
+   #include <emmintrin.h>
+   #define JSON_SCAN_SSE2
+#endif
+
 #ifndef JSON_INT_T_OVERRIDDEN
    #if defined(_MSC_VER)
       /* https://docs.microsoft.com/en-us/cpp/cpp/data-type-ranges */
@@ -67,6 +73,58 @@
 
 typedef unsigned int json_uchar;
 
+/* Find the next quote, backslash or NUL in a string (or end), so runs of plain
+ * string bytes can be copied at once rather than through the state machine
+ * (which rejects a NUL as before).
+ */
+static const json_char * scan_string (const json_char * p, const json_char * end)
+{
+   #ifdef JSON_SCAN_SSE2
+
+      const __m128i quote = _mm_set1_epi8 ('"');
+      const __m128i backslash = _mm_set1_epi8 ('\\');
+      const __m128i nul = _mm_setzero_si128 ();
+
+      while (end - p >= 16)
+      {
+         __m128i chunk = _mm_loadu_si128 ((const __m128i *) p);
+         int mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, nul),
+               _mm_or_si128 (_mm_cmpeq_epi8 (chunk, quote), _mm_cmpeq_epi8 (chunk, backslash))));
+
+         if (mask)
+            return p + __builtin_ctz (mask);
+
+         p += 16;
+      }
+
+   #else
+
+      /* 8 bytes at a time: a byte of x ^ c is zero where it equals c */
+      const unsigned long long ones = 0x0101010101010101ULL;
+      const unsigned long long highs = 0x8080808080808080ULL;
+
+      while (end - p >= 8)
+      {
+         unsigned long long word, q, b;
+
+         memcpy (&word, p, 8);
+         q = word ^ (ones * '"');
+         b = word ^ (ones * '\\');
+
+         if ((((q - ones) & ~q) | ((b - ones) & ~b) | ((word - ones) & ~word)) & highs)
+            break;
+
+         p += 8;
+      }
+
+   #endif
+
+   while (p < end && *p && *p != '"' && *p != '\\')
+      ++ p;
+
+   return p;
+}
+
 const struct _json_value json_value_none;
 
 static unsigned char hex_value (json_char c)
@@ -133,7 +191,8 @@ static int new_value (json_state * state,
                       json_type type)
 {
    json_value * value;
-   size_t values_size;
+   size_t values_size, index_size;
+   unsigned int index_slots;
 
    if (!state->first_pass)
    {
@@ -166,17 +225,42 @@ static int new_value (json_state * state,
 
             values_size = sizeof (*value->u.object.values) * value->u.object.length;
 
+            index_slots = 0;
+
+            if ((state->settings.settings & json_enable_index)
+                  && value->u.object.length >= json_index_min)
+            {
+               /* keep the table at most half full */
+               index_slots = 1;
+
+               while (index_slots < 2 * value->u.object.length)
+                  index_slots <<= 1;
+
+               index_size = sizeof (json_object_index) + (index_slots - 1) * sizeof (unsigned int);
+            }
+            else
+               index_size = 0;
+
             if (! (value->u.object.values = (json_object_entry *) json_alloc
                #ifdef UINTPTR_MAX
-                  (state, values_size + ((uintptr_t) value->u.object.values), 0)) )
+                  (state, values_size + index_size + ((uintptr_t) value->u.object.values), 0)) )
                #else
-                  (state, values_size + ((size_t) value->u.object.values), 0)) )
+                  (state, values_size + index_size + ((size_t) value->u.object.values), 0)) )
                #endif
             {
                return 0;
             }
 
-            value->_reserved.object_mem = (void *) (((char *) value->u.object.values) + values_size);
+            if (index_slots)
+            {
+               json_object_index * index = (json_object_index *) (((char *) value->u.object.values) + values_size);
+
+               index->mask = index_slots - 1;
+               memset (index->slots, 0, index_slots * sizeof (unsigned int));
+               json_value_index (value) = index;
+            }
+
+            value->_reserved.object_mem = (void *) (((char *) value->u.object.values) + values_size + index_size);
 
             value->u.object.length = 0;
             break;
@@ -286,6 +370,12 @@ json_value * json_parse_ex (json_settings * settings,
    if (!state.settings.mem_free)
       state.settings.mem_free = default_free;
 
+   if ((state.settings.settings & json_enable_index)
+         && state.settings.value_extra < sizeof (json_object_index *))
+   {
+      state.settings.value_extra = sizeof (json_object_index *);
+   }
+
    for (state.first_pass = 1; state.first_pass >= 0; -- state.first_pass)
    {
       json_uchar uchar;
@@ -444,6 +534,20 @@ json_value * json_parse_ex (json_settings * settings,
                         top->u.object.values [top->u.object.length].name_length
                            = string_length;
 
+                        if ((state.settings.settings & json_enable_index)
+                              && json_value_index (top))
+                        {
+                           json_object_index * index = json_value_index (top);
+                           unsigned int slot = json_key_hash
+                              (top->u.object.values [top->u.object.length].name, string_length) & index->mask;
+
+                           /* linear probing; duplicate keys stay in order, so the first wins */
+                           while (index->slots [slot])
+                              slot = (slot + 1) & index->mask;
+
+                           index->slots [slot] = top->u.object.length + 1;
+                        }
+
                         (*(json_char **) &top->_reserved.object_mem) += string_length + 1;
                      }
 
@@ -456,7 +560,18 @@ json_value * json_parse_ex (json_settings * settings,
             }
             else
             {
-               string_add (b);
+               const json_char * run_end = scan_string (state.ptr + 1, end);
+               size_t run = run_end - state.ptr;
+
+               if (run > UINT_MAX - 8 - string_length)
+                  goto e_overflow;
+
+               if (!state.first_pass)
+                  memcpy (string + string_length, state.ptr, run);
+
+               string_length += run;
+               state.ptr = run_end - 1;  /* the loop steps onto the quote or backslash */
+
                continue;
             }
          }
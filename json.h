@@ -80,6 +80,7 @@ typedef struct
 } json_settings;
 
 #define json_enable_comments  0x01
+#define json_enable_index     0x02  /* index the keys of larger objects (see json_value_index) */
 
 typedef enum
 {
@@ -262,6 +263,33 @@ typedef struct _json_value
 
 } json_value;
 
+/* With json_enable_index, objects with at least json_index_min members get a
+ * hash table of their keys, pointed to from the start of their value_extra
+ * space (which is grown to fit if needed); other values have NULL there.
+ */
+#define json_index_min 8
+
+typedef struct _json_object_index
+{
+   unsigned int mask;  /* number of slots - 1 */
+   unsigned int slots [1];  /* entry index + 1, or 0 if empty */
+
+} json_object_index;
+
+#define json_value_index(value) \
+   (*(json_object_index **) ((json_value *) (value) + 1))
+
+/* FNV-1a */
+static inline unsigned int json_key_hash (const json_char * key, unsigned int length)
+{
+   unsigned int h = 2166136261u;
+
+   while (length --)
+      h = (h ^ (unsigned char) *key ++) * 16777619u;
+
+   return h;
+}
+
 json_value * json_parse (const json_char * json,
                          size_t length);
 
@@ -1,12 +1,19 @@
 #include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
 #endif
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define WS_MASK_SSE2
+#endif
+
 #include <cipher.h>
 #include <debug.h>
 #include <sslconn.h>
@@ -26,10 +33,13 @@ static const char WS_SALT[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
 #define WS_OP_PING 0x09
 #define WS_OP_PONG 0x0A
 #define WS_MASK	0x80
-#define MAX_FRAG 64
+#define WS_ZBUF_CHUNK 4096
+#define WS_READ_MIN 1024 /* compact input when there's less room than this left to read into */
+#define WS_DEFLATE_MIN 64 /* don't bother compressing shorter messages */
 
 struct buffer {
 	guchar *buf;
+	gsize start; /* first unconsumed byte (input only) */
 	gsize off; /* next byte to read/write to */
 	gsize len; /* (expected) size of data in buffer */
 	gsize siz; /* allocated size of buffer */
@@ -51,6 +61,22 @@ struct _PurpleWebsocket {
 
 	gboolean connected;
 	PurpleInputCondition closed;
+
+	/* permessage-deflate */
+	PurpleWebsocketDeflate deflate_offer;
+	gboolean deflate_offered;
+	z_stream *inflate, *deflate; /* deflate only if compressing */
+	gboolean inflate_reset, deflate_reset; /* no context takeover */
+	struct buffer zbuf; /* last compressed message sent */
+
+	/* the data message being received */
+	uint8_t message_header; /* op and RSV1 of its first frame, or 0 if none */
+	struct buffer message; /* what we have of it (after inflating) */
+	guint64 frame_left; /* payload still to come of a frame being streamed */
+	gboolean frame_fin;
+	size_t partial; /* see purple_websocket_set_partial */
+
+	PurpleWebsocketStats stats;
 };
 
 static void buffer_set_len(struct buffer *b, size_t n) {
@@ -61,10 +87,20 @@ static void buffer_set_len(struct buffer *b, size_t n) {
 	b->len = n;
 }
 
-static inline guchar *buffer_incr(struct buffer *b, size_t n) {
-	gsize l = b->len;
-	buffer_set_len(b, l + n);
-	return &b->buf[l];
+/* move unconsumed input to the front */
+static void buffer_compact(struct buffer *b) {
+	memmove(b->buf, b->buf + b->start, b->off - b->start);
+	b->off -= b->start;
+	b->len -= b->start;
+	b->start = 0;
+}
+
+/* make room for at least n more bytes after len */
+static void buffer_reserve(struct buffer *b, size_t n) {
+	if (b->len + n > b->siz) {
+		b->siz = MAX(b->len + n, 2*b->siz);
+		b->buf = g_realloc(b->buf, b->siz);
+	}
 }
 
 void purple_websocket_abort(PurpleWebsocket *ws) {
@@ -73,6 +109,8 @@ void purple_websocket_abort(PurpleWebsocket *ws) {
 	
 	if (ws->ssl_connection != NULL)
 		purple_ssl_close(ws->ssl_connection);
+	else if (ws->fd >= 0)
+		close(ws->fd);
 
 	if (ws->connection != NULL)
 		purple_proxy_connect_cancel(ws->connection);
@@ -81,9 +119,20 @@ void purple_websocket_abort(PurpleWebsocket *ws) {
 	if (ws->inpa > 0)
 		purple_input_remove(ws->inpa);
 
+	if (ws->inflate) {
+		inflateEnd(ws->inflate);
+		g_free(ws->inflate);
+	}
+	if (ws->deflate) {
+		deflateEnd(ws->deflate);
+		g_free(ws->deflate);
+	}
+
 	g_free(ws->key);
 	g_free(ws->output.buf);
 	g_free(ws->input.buf);
+	g_free(ws->zbuf.buf);
+	g_free(ws->message.buf);
 
 	g_free(ws);
 }
@@ -128,6 +177,94 @@ static const char *find_header_content(const char *data, const char *name) {
 	return NULL;
 }
 
+/* The value of an extension parameter called name ("" if none), or NULL if it's not that one */
+static const char *ws_param_value(char *param, const char *name) {
+	size_t l = strlen(name);
+	if (g_ascii_strncasecmp(param, name, l))
+		return NULL;
+	param = g_strchug(param + l);
+	if (!*param)
+		return param;
+	if (*param != '=')
+		return NULL;
+	return g_strchug(param + 1);
+}
+
+static gboolean ws_window_bits(const char *value, int min, int *bits) {
+	if (*value == '"')
+		value++;
+	int b = atoi(value);
+	if (b < min || b > 15)
+		return FALSE;
+	*bits = b;
+	return TRUE;
+}
+
+/* Accept the permessage-deflate parameters the server agreed to */
+static gboolean ws_deflate_init(PurpleWebsocket *ws, gchar **params) {
+	if (!ws->deflate_offered || ws->inflate)
+		return FALSE;
+
+	int client_bits = ws->deflate_offer.client_max_window_bits ?: 15;
+	ws->deflate_reset = ws->deflate_offer.client_no_context_takeover;
+	for (; *params; params++) {
+		char *param = g_strstrip(*params);
+		const char *v;
+		int bits;
+		if ((v = ws_param_value(param, "server_no_context_takeover")) && !*v)
+			ws->inflate_reset = TRUE;
+		else if ((v = ws_param_value(param, "client_no_context_takeover")) && !*v)
+			ws->deflate_reset = TRUE;
+		else if ((v = ws_param_value(param, "server_max_window_bits"))) {
+			/* inflate always uses the full window, which works for any smaller one */
+			if (!ws_window_bits(v, 8, &bits))
+				return FALSE;
+		} else if ((v = ws_param_value(param, "client_max_window_bits"))) {
+			/* zlib can't do 8 bit raw windows, so we just won't compress then */
+			if (!ws_window_bits(v, 8, &client_bits))
+				return FALSE;
+		} else
+			return FALSE;
+	}
+
+	ws->inflate = g_new0(z_stream, 1);
+	if (inflateInit2(ws->inflate, -MAX_WBITS) != Z_OK) {
+		g_free(ws->inflate);
+		ws->inflate = NULL;
+		return FALSE;
+	}
+
+	if (ws->deflate_offer.compress && client_bits >= 9) {
+		ws->deflate = g_new0(z_stream, 1);
+		if (deflateInit2(ws->deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -client_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			g_free(ws->deflate);
+			ws->deflate = NULL;
+		}
+	}
+
+	purple_debug_misc("websocket", "permessage-deflate%s%s, client window %d\n",
+			ws->inflate_reset ? " server_no_context_takeover" : "",
+			ws->deflate_reset ? " client_no_context_takeover" : "",
+			client_bits);
+	return TRUE;
+}
+
+/* Handle a Sec-WebSocket-Extensions response header: we can only accept what we offered */
+static gboolean ws_extensions(PurpleWebsocket *ws, const char *header) {
+	gchar **exts = g_strsplit(header, ",", -1);
+	gboolean ok = TRUE;
+	for (gchar **e = exts; ok && *e; e++) {
+		gchar **params = g_strsplit(*e, ";", -1);
+		if (!params[0] || g_ascii_strcasecmp(g_strstrip(params[0]), "permessage-deflate"))
+			ok = FALSE;
+		else
+			ok = ws_deflate_init(ws, &params[1]);
+		g_strfreev(params);
+	}
+	g_strfreev(exts);
+	return ok;
+}
+
 static gboolean ws_read_headers(PurpleWebsocket *ws, const char *headers) {
 	const char *upgrade = skip_lws(find_header_content(headers, "Upgrade"));
 	if (upgrade && (g_ascii_strncasecmp(upgrade, "websocket", 9) != 0 || skip_lws(upgrade+9)))
@@ -156,29 +293,177 @@ static gboolean ws_read_headers(PurpleWebsocket *ws, const char *headers) {
 		g_free(b);
 	}
 
-	/* TODO: Sec-WebSocket-Extensions, Sec-WebSocket-Protocol */
+	/* TODO: Sec-WebSocket-Protocol */
 
 	if (strncmp(headers, "HTTP/1.1 101 ", 13) != 0 || !upgrade || !connection || !accept) {
 		ws_error(ws, headers);
 		return FALSE;
 	}
 
+	const char *extensions = skip_lws(find_header_content(headers, "Sec-WebSocket-Extensions"));
+	if (extensions) {
+		const char *e = strstr(extensions, "\r\n");
+		char *ext = e ? g_strndup(extensions, e - extensions) : g_strdup(extensions);
+		gboolean ok = ws_extensions(ws, ext);
+		g_free(ext);
+		if (!ok) {
+			ws_error(ws, "Unsupported websocket extension");
+			return FALSE;
+		}
+	}
+
 	ws->connected = TRUE;
 	ws->callback(ws, ws->user_data, PURPLE_WEBSOCKET_OPEN, NULL, 0);
 	return TRUE;
 }
 
-static size_t ws_read_message(PurpleWebsocket *ws) {
-	uint8_t *input = ws->input.buf;
-	size_t len = ws->input.off;
+/* Compress a message into ws->zbuf, ending with a sync flush */
+static gboolean ws_deflate(PurpleWebsocket *ws, const guchar *msg, size_t len) {
+	z_stream *z = ws->deflate;
+	struct buffer *b = &ws->zbuf;
+	b->len = 0;
+	z->next_in = (Bytef *)msg;
+	z->avail_in = len;
+	for (;;) {
+		buffer_reserve(b, MAX(WS_ZBUF_CHUNK, z->avail_in));
+		z->next_out = b->buf + b->len;
+		z->avail_out = b->siz - b->len;
+		int r = deflate(z, Z_SYNC_FLUSH);
+		b->len = b->siz - z->avail_out;
+		if (r != Z_OK && r != Z_BUF_ERROR)
+			return FALSE;
+		/* done once all the input is used and it's stopped filling the output */
+		if (!z->avail_in && z->avail_out)
+			return TRUE;
+	}
+}
+
+static void ws_deliver(PurpleWebsocket *ws, PurpleWebsocketOp op, const guchar *p, size_t l) {
+	ws->stats.in += l;
+	purple_debug_misc("websocket", "message %x len %lu\n", op, (unsigned long) l);
+	ws->callback(ws, ws->user_data, op, p, l);
+}
+
+/* Inflate payload of the current (compressed) data message into ws->message, delivering it as for ws_data */
+static gboolean ws_inflate(PurpleWebsocket *ws, PurpleWebsocketOp op, const guchar *p, size_t l, gboolean fin) {
+	/* the sync flush marker stripped by the sender */
+	static const guchar tail[4] = { 0x00, 0x00, 0xff, 0xff };
+	z_stream *z = ws->inflate;
+	struct buffer *b = &ws->message;
+	gboolean tailed = FALSE;
+
+	z->next_in = (Bytef *)p;
+	z->avail_in = l;
+	for (;;) {
+		buffer_reserve(b, WS_ZBUF_CHUNK);
+		z->next_out = b->buf + b->len;
+		z->avail_out = b->siz - b->len;
+		if (ws->partial)
+			/* (less than partial is ever left in b) */
+			z->avail_out = MIN(z->avail_out, ws->partial - b->len);
+		int r = inflate(z, Z_SYNC_FLUSH);
+		b->len = z->next_out - b->buf;
+		if (r == Z_STREAM_END)
+			/* a final block ends the stream: the next message starts a new one */
+			inflateReset(z);
+		else if (r != Z_OK && r != Z_BUF_ERROR) {
+			ws_error(ws, "Invalid compressed message");
+			return FALSE;
+		}
+
+		if (ws->partial && b->len >= ws->partial) {
+			/* compressed json expands a lot, so this can happen any number of times for one frame */
+			ws_deliver(ws, op | PURPLE_WEBSOCKET_PARTIAL, b->buf, b->len);
+			b->len = 0;
+		}
+
+		/* done once all the input is used and it's stopped filling the output */
+		if (z->avail_in || !z->avail_out)
+			continue;
+		if (!fin)
+			return TRUE;
+		if (tailed)
+			break;
+		z->next_in = (Bytef *)tail;
+		z->avail_in = sizeof(tail);
+		tailed = TRUE;
+	}
+
+	if (ws->inflate_reset)
+		inflateReset(z);
+	ws->message_header = 0;
+	l = b->len;
+	b->len = 0;
+	ws_deliver(ws, op, b->buf, l);
+	return TRUE;
+}
+
+/* Add payload of the current data message, delivering it when it's complete (fin) or, in partial mode, big enough.
+ * Returns FALSE on error, when ws is gone. */
+static gboolean ws_data(PurpleWebsocket *ws, const guchar *p, size_t l, gboolean fin) {
+	struct buffer *b = &ws->message;
+	PurpleWebsocketOp op = ws->message_header & WS_OP_MASK;
+
+	ws->stats.in_wire += l;
+	if (ws->message_header & WS_RSV1)
+		return ws_inflate(ws, op, p, l, fin);
+
+	if (b->len || !fin) {
+		/* anything but a whole message in one frame has to be collected */
+		buffer_reserve(b, l);
+		memcpy(&b->buf[b->len], p, l);
+		b->len += l;
+		p = b->buf;
+		l = b->len;
+	}
+
+	if (fin)
+		ws->message_header = 0;
+	else if (ws->partial && l >= ws->partial)
+		op |= PURPLE_WEBSOCKET_PARTIAL;
+	else
+		return TRUE;
+	/* p stays valid until more is added */
+	b->len = 0;
+	ws_deliver(ws, op, p, l);
+	return TRUE;
+}
+
+/* Time the round trip of a reply to purple_websocket_ping (others are unsolicited) */
+static void ws_pong(PurpleWebsocket *ws, const guchar *p, size_t l) {
+	guint64 t;
+	if (l != sizeof(t))
+		return;
+	memcpy(&t, p, sizeof(t));
+	gint64 sent = GUINT64_FROM_BE(t);
+	gint64 rtt = g_get_monotonic_time() - sent;
+	if (sent <= 0 || sent > ws->stats.ping_sent || rtt < 0)
+		return;
+
+	PurpleWebsocketStats *s = &ws->stats;
+	s->pongs++;
+	s->unanswered = 0;
+	s->rtt = rtt;
+	s->srtt = s->srtt ? (7*s->srtt + rtt)/8 : rtt;
+	if (rtt > s->rtt_max)
+		s->rtt_max = rtt;
+}
+
+/* Handle the frame (or the next piece of a streamed frame) at input.start, returning how much was used,
+ * or the length needed to complete it if more than is available (or 0 on error, when ws is gone) */
+static size_t ws_read_frame(PurpleWebsocket *ws) {
+	uint8_t *input = ws->input.buf + ws->input.start;
+	size_t len = ws->input.off - ws->input.start;
 	size_t off = 0;
-	struct {
-		guchar *p;
-		size_t l;
-	} frag[MAX_FRAG];
-	unsigned fi;
 
-	for (fi = 0; fi < MAX_FRAG; fi ++) {
+	if (ws->frame_left) {
+		size_t n = MIN(len, ws->frame_left);
+		ws->frame_left -= n;
+		if (!ws_data(ws, input, n, ws->frame_fin && !ws->frame_left))
+			return 0;
+		return n;
+	}
+
 #define GETN(N) ({ \
 		if (len-off < (N)) \
 			return off+N; \
@@ -189,75 +474,104 @@ static size_t ws_read_message(PurpleWebsocket *ws) {
 #define GETB(T) (*(uint8_t*)GETN(1))
 #define GET(V) memcpy(&(V), GETN(sizeof(V)), sizeof(V))
 
-		if (len-off < 2)
-			return off+2;
-		uint8_t header = GETB(uint8_t);
-		if (header & ~(WS_OP_MASK|WS_FIN)) {
-			ws_error(ws, "Unsupported RSV flag");
+	if (len-off < 2)
+		return off+2;
+	uint8_t header = GETB(uint8_t);
+	uint8_t op = header & WS_OP_MASK;
+	/* control frames have the 0x08 bit, and can come between the fragments of a message */
+	gboolean control = op & WS_OP_CLOS;
+	uint8_t rsv = header & (WS_RSV1|WS_RSV2|WS_RSV3);
+	/* RSV1 marks compressed messages: only on their first frame */
+	if (rsv && (rsv != WS_RSV1 || !ws->inflate || control || op == WS_OP_CONT)) {
+		ws_error(ws, "Unsupported RSV flag");
+		return 0;
+	}
+	uint8_t mlen = GETB(uint8_t);
+	if (mlen & WS_MASK) {
+		ws_error(ws, "Masked frame");
+		return 0;
+	}
+	uint64_t plen = mlen & ~WS_MASK;
+	uint16_t tlen;
+	switch (plen) {
+		case 127:
+			GET(plen);
+			plen = GUINT64_FROM_BE(plen);
+			break;
+		case 126:
+			GET(tlen);
+			plen = GUINT16_FROM_BE(tlen);
+			break;
+	}
+
+	if (control) {
+		if (!(header & WS_FIN) || plen > 125) {
+			ws_error(ws, "Invalid control frame");
 			return 0;
 		}
-		uint8_t mlen = GETB(uint8_t);
-		if (mlen & WS_MASK) {
-			ws_error(ws, "Masked frame");
+	} else if (op == WS_OP_CONT) {
+		if (!ws->message_header) {
+			ws_error(ws, "Unexpected continuation frame");
 			return 0;
 		}
-		uint64_t plen = mlen & ~WS_MASK;
-		uint16_t tlen;
-		switch (plen) {
-			case 127:
-				GET(plen);
-				plen = GUINT64_FROM_BE(plen);
-				break;
-			case 126:
-				GET(tlen);
-				plen = GUINT16_FROM_BE(tlen);
-				break;
+	} else if (op == WS_OP_TEXT || op == WS_OP_BIN) {
+		if (ws->message_header) {
+			ws_error(ws, "Expected continuation frame");
+			return 0;
 		}
-		frag[fi].l = plen;
-		frag[fi].p = GETN(plen);
-	
+	} else {
+		ws_error(ws, "Unknown frame op");
+		return 0;
+	}
+
+	/* (nothing is changed until the whole frame is here, as we'll be back to parse it again if not) */
+	guchar *p = NULL;
+	if (!control && ws->partial && plen > ws->partial && plen > len-off) {
+		/* too big to wait for: take the payload as it comes */
+		ws->frame_left = plen;
+		ws->frame_fin = header & WS_FIN;
+	} else
+		p = GETN(plen);
+
 #undef GET
 #undef GETB
 #undef GETN
 
-		if (header & WS_FIN) {
-			/* consolidate all the fragments after the first */
-			unsigned i;
-			for (i = 1; i <= fi; i++) {
-				memmove(&frag[0].p[frag[0].l], frag[i].p, frag[i].l);
-				frag[0].l += frag[i].l;
-			}
-
-			purple_debug_misc("websocket", "message %x len %lu\n", input[0], (unsigned long) frag[0].l);
-			uint8_t op = input[0] & WS_OP_MASK;
-			switch (op) {
-				case WS_OP_TEXT:
-				case WS_OP_BIN:
-				case WS_OP_PONG:
-				case WS_OP_CLOS:
-					ws->callback(ws, ws->user_data, (PurpleWebsocketOp)op, frag[0].p, frag[0].l);
-					if (op == WS_OP_CLOS) {
-						ws->closed |= PURPLE_INPUT_READ;
-						if (ws->closed & PURPLE_INPUT_WRITE) {
-							purple_websocket_abort(ws);
-							return 0;
-						} else
-							purple_websocket_send(ws, PURPLE_WEBSOCKET_CLOSE, NULL, 0);
-					}
-					break;
-				case WS_OP_PING:
-					purple_websocket_send(ws, PURPLE_WEBSOCKET_PONG, frag[0].p, frag[0].l);
-					break;
-				default:
-					ws_error(ws, "Unknown frame op");
+	if (op == WS_OP_TEXT || op == WS_OP_BIN)
+		ws->message_header = header & (WS_OP_MASK|WS_RSV1);
+	if (ws->frame_left)
+		return off;
+
+	switch (op) {
+		case WS_OP_PONG:
+			ws_pong(ws, p, plen);
+			/* fall through */
+		case WS_OP_CLOS:
+			purple_debug_misc("websocket", "message %x len %lu\n", op, (unsigned long) plen);
+			ws->callback(ws, ws->user_data, (PurpleWebsocketOp)op, p, plen);
+			if (op == WS_OP_CLOS) {
+				ws->closed |= PURPLE_INPUT_READ;
+				if (ws->closed & PURPLE_INPUT_WRITE) {
+					purple_websocket_abort(ws);
 					return 0;
+				} else
+					purple_websocket_send(ws, PURPLE_WEBSOCKET_CLOSE, NULL, 0);
 			}
-			return off;
-		}
+			break;
+		case WS_OP_PING:
+			purple_websocket_send(ws, PURPLE_WEBSOCKET_PONG, p, plen);
+			break;
+		case WS_OP_CONT:
+		case WS_OP_TEXT:
+		case WS_OP_BIN:
+			if (!ws_data(ws, p, plen, header & WS_FIN))
+				return 0;
+			break;
+		default:
+			ws_error(ws, "Unknown frame op");
+			return 0;
 	}
-
-	ws_error(ws, "Maximum fragment count exceeded");
-	return 0;
+	return off;
 }
 
 static void ws_input_cb(gpointer data, gint source, PurpleInputCondition cond);
@@ -317,6 +631,8 @@ static void ws_input_cb(gpointer data, G_GNUC_UNUSED gint source, PurpleInputCon
 
 	while (cond & PURPLE_INPUT_READ) {
 		g_return_if_fail(ws->input.off < ws->input.len);
+		if (ws->input.start && ws->input.siz - ws->input.off < WS_READ_MIN)
+			buffer_compact(&ws->input);
 		gssize len = ws->ssl_connection
 			? purple_ssl_read(ws->ssl_connection, ws->input.buf + ws->input.off, ws->input.siz - ws->input.off)
 			: read(ws->fd, ws->input.buf + ws->input.off, ws->input.siz - ws->input.off);
@@ -339,6 +655,7 @@ static void ws_input_cb(gpointer data, G_GNUC_UNUSED gint source, PurpleInputCon
 			*/
 
 			ws->input.off += len;
+			ws->stats.last_in = g_get_monotonic_time();
 
 			if (!ws->connected) {
 				/* search for the end of headers in the new block (backing up 4-1) */
@@ -355,8 +672,8 @@ static void ws_input_cb(gpointer data, G_GNUC_UNUSED gint source, PurpleInputCon
 					if (!ws_read_headers(ws, resp))
 						return;
 
-					memmove(ws->input.buf, eoh, ws->input.off -= eoh - resp);
-					ws->input.len = 2;
+					ws->input.start = eoh - resp;
+					ws->input.len = ws->input.start + 2;
 				}
 				else if (ws->input.off >= ws->input.len) {
 					ws_error(ws, "Response headers too long");
@@ -367,59 +684,97 @@ static void ws_input_cb(gpointer data, G_GNUC_UNUSED gint source, PurpleInputCon
 			}
 			
 			while (ws->input.off >= ws->input.len) {
-				size_t r = ws_read_message(ws);
+				size_t r = ws_read_frame(ws);
 				if (!r) /* error */
 					return;
-				else if (r > ws->input.off) {
-					/* need more */
-					buffer_set_len(&ws->input, r);
+				else if (r > ws->input.off - ws->input.start) {
+					/* need more: only move what we have if it won't fit otherwise */
+					if (ws->input.start + r > ws->input.siz)
+						buffer_compact(&ws->input);
+					buffer_set_len(&ws->input, ws->input.start + r);
 				} else {
 					/* consumed some */
-					memmove(ws->input.buf, ws->input.buf + r, ws->input.off -= r);
-					ws->input.len = 2;
+					ws->input.start += r;
+					if (ws->input.start == ws->input.off)
+						ws->input.start = ws->input.off = 0;
+					/* a frame header, or any of the rest of a streamed frame */
+					ws->input.len = ws->input.start + (ws->frame_left ? 1 : 2);
 				}
 			}
 		}
 	}
 }
 
+/* out = in ^ mask (repeated) */
+static void ws_mask(guchar *out, const guchar *in, size_t len, const guchar mask[4]) {
+	guint32 m32;
+	memcpy(&m32, mask, 4);
+	/* both halves the same, so it's in byte order either way */
+	guint64 m64 = m32 | (guint64)m32 << 32;
+	size_t i = 0;
+#ifdef WS_MASK_SSE2
+	__m128i m128 = _mm_set1_epi64x(m64);
+	for (; i+16 <= len; i += 16)
+		_mm_storeu_si128((__m128i *)&out[i], _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i]), m128));
+#endif
+	for (; i+8 <= len; i += 8) {
+		guint64 v;
+		memcpy(&v, &in[i], 8);
+		v ^= m64;
+		memcpy(&out[i], &v, 8);
+	}
+	for (; i < len; i++)
+		out[i] = in[i] ^ mask[i&3];
+}
+
 void purple_websocket_send(PurpleWebsocket *ws, PurpleWebsocketOp op, const guchar *msg, size_t len) {
 	g_return_if_fail(ws);
 	g_return_if_fail(ws->connected && !(ws->closed & PURPLE_INPUT_WRITE));
 	g_return_if_fail(!(op & ~WS_OP_MASK));
 	gboolean buf = ws->output.len;
+	uint8_t header = WS_FIN | op;
+
+	if (op == PURPLE_WEBSOCKET_TEXT || op == PURPLE_WEBSOCKET_BINARY) {
+		ws->stats.out += len;
+		/* once it's been through deflate it has to be sent compressed, as the server's window needs it */
+		if (ws->deflate && len >= WS_DEFLATE_MIN) {
+			if (!ws_deflate(ws, msg, len) || ws->zbuf.len < 4) {
+				ws_error(ws, "Compression failed");
+				return;
+			}
+			if (ws->deflate_reset)
+				deflateReset(ws->deflate);
+			header |= WS_RSV1;
+			msg = ws->zbuf.buf;
+			/* strip the sync flush marker */
+			len = ws->zbuf.len - 4;
+		}
+		ws->stats.out_wire += len;
+	}
 
-#define ADDB(V) (*(uint8_t*)buffer_incr(&ws->output, 1) = (V))
-#define ADD(T, V) ({ \
-		T _v = (V); \
-		memcpy(buffer_incr(&ws->output, sizeof(T)), &_v, sizeof(T)); \
-	})
+	/* frames are built straight into the output buffer, after any still waiting there,
+	 * so everything sent before we get back to the main loop goes out in one write */
+	size_t hlen = 2 + (len > UINT16_MAX ? 8 : len >= 126 ? 2 : 0) + 4;
+	buffer_reserve(&ws->output, hlen + len);
+	guchar *f = &ws->output.buf[ws->output.len];
+	ws->output.len += hlen + len;
 
-	ADDB(WS_FIN | op);
+	f[0] = header;
 	if (len > UINT16_MAX) {
-		ADDB(WS_MASK | 127);
-		ADD(uint64_t, GUINT64_TO_BE(len));
+		f[1] = WS_MASK | 127;
+		uint64_t l = GUINT64_TO_BE(len);
+		memcpy(&f[2], &l, 8);
 	} else if (len >= 126) {
-		ADDB(WS_MASK | 126);
-		ADD(uint16_t, GUINT16_TO_BE(len));
-	} else {
-		ADDB(WS_MASK | len);
-	}
+		f[1] = WS_MASK | 126;
+		uint16_t l = GUINT16_TO_BE(len);
+		memcpy(&f[2], &l, 2);
+	} else
+		f[1] = WS_MASK | len;
 
-	uint32_t mask = g_random_int();
-	ADD(uint32_t, mask);
-
-#undef ADD
-#undef ADDB
-
-	guchar *p = buffer_incr(&ws->output, len);
-	size_t i;
-	for (i = 0; i+3 < len; i+=4) {
-		uint32_t m = *(uint32_t*)&msg[i] ^ mask;
-		memcpy(&p[i], &m, 4);
-	}
-	for (; i < len; i++)
-		p[i] = msg[i] ^ ((uint8_t*)&mask)[i&3];
+	guchar *mask = &f[hlen-4];
+	guint32 key = g_random_int();
+	memcpy(mask, &key, 4);
+	ws_mask(&f[hlen], msg, len, mask);
 
 	if (op == PURPLE_WEBSOCKET_CLOSE)
 		ws->closed |= PURPLE_INPUT_WRITE;
@@ -428,6 +783,27 @@ void purple_websocket_send(PurpleWebsocket *ws, PurpleWebsocketOp op, const guch
 		ws_input(ws);
 }
 
+void purple_websocket_set_partial(PurpleWebsocket *ws, size_t chunk) {
+	ws->partial = chunk;
+}
+
+const PurpleWebsocketStats *purple_websocket_stats(PurpleWebsocket *ws) {
+	return &ws->stats;
+}
+
+void purple_websocket_ping(PurpleWebsocket *ws) {
+	g_return_if_fail(ws);
+	gint64 now = g_get_monotonic_time();
+	ws->stats.ping_sent = now;
+	ws->stats.pings++;
+	ws->stats.unanswered++;
+	if (!ws->connected || ws->closed & PURPLE_INPUT_WRITE)
+		return;
+	/* the payload is the time sent, so the reply says when its ping was sent */
+	guint64 t = GUINT64_TO_BE(now);
+	purple_websocket_send(ws, PURPLE_WEBSOCKET_PING, (const guchar *)&t, sizeof(t));
+}
+
 static void wss_input_cb(gpointer data, G_GNUC_UNUSED PurpleSslConnection *ssl_connection, PurpleInputCondition cond)
 {
 	PurpleWebsocket *ws = data;
@@ -467,6 +843,7 @@ static void ws_connect_cb(gpointer data, gint source, const gchar *error_message
 
 PurpleWebsocket *purple_websocket_connect(PurpleAccount *account,
 		const char *url, const char *protocol, const char *cookies,
+		const PurpleWebsocketDeflate *deflate,
 		PurpleWebsocketCallback callback, void *user_data) {
 	gboolean ssl = FALSE;
 
@@ -491,6 +868,7 @@ PurpleWebsocket *purple_websocket_connect(PurpleAccount *account,
 	ws->callback = callback;
 	ws->user_data = user_data;
 	ws->fd = -1;
+	ws->stats.last_in = g_get_monotonic_time();
 
 	char *host, *path;
 	int port;
@@ -520,6 +898,22 @@ Sec-WebSocket-Version: 13\r\n", path, host, ws->key);
 			g_string_append_printf(request, "Sec-WebSocket-Protocol: %s\r\n", protocol);
 		if (cookies)
 			g_string_append_printf(request, "Cookie: %s\r\n", cookies);
+		if (deflate) {
+			ws->deflate_offer = *deflate;
+			ws->deflate_offered = TRUE;
+			g_string_append(request, "Sec-WebSocket-Extensions: permessage-deflate");
+			if (deflate->server_no_context_takeover)
+				g_string_append(request, "; server_no_context_takeover");
+			if (deflate->client_no_context_takeover)
+				g_string_append(request, "; client_no_context_takeover");
+			if (deflate->server_max_window_bits)
+				g_string_append_printf(request, "; server_max_window_bits=%d", deflate->server_max_window_bits);
+			if (deflate->client_max_window_bits)
+				g_string_append_printf(request, "; client_max_window_bits=%d", deflate->client_max_window_bits);
+			else
+				g_string_append(request, "; client_max_window_bits");
+			g_string_append(request, "\r\n");
+		}
 		g_string_append(request, "\r\n");
 
 		ws->output.len = request->len;
@@ -13,12 +13,45 @@ typedef enum _PurpleWebsocketOp {
 	PURPLE_WEBSOCKET_PING   = 0x09,
 	PURPLE_WEBSOCKET_PONG   = 0x0A,
 	PURPLE_WEBSOCKET_OPEN   = 0x10,
+	/* with purple_websocket_set_partial: a piece of a TEXT or BINARY message, the rest of which follows */
+	PURPLE_WEBSOCKET_PARTIAL        = 0x20,
+	PURPLE_WEBSOCKET_TEXT_PARTIAL   = PURPLE_WEBSOCKET_PARTIAL | PURPLE_WEBSOCKET_TEXT,
+	PURPLE_WEBSOCKET_BINARY_PARTIAL = PURPLE_WEBSOCKET_PARTIAL | PURPLE_WEBSOCKET_BINARY,
 } PurpleWebsocketOp;
 
 typedef void (*PurpleWebsocketCallback)(PurpleWebsocket *ws, gpointer user_data, PurpleWebsocketOp op, const guchar *msg, size_t len);
 
-PurpleWebsocket *purple_websocket_connect(PurpleAccount *account, const char *url, const char *protocol, const char *cookies, PurpleWebsocketCallback callback, void *user_data);
+/* permessage-deflate (RFC 7692) parameters to offer; zeros give the defaults (15 bit windows with context takeover) */
+typedef struct _PurpleWebsocketDeflate {
+	int server_max_window_bits; /* 8-15, or 0 to let the server choose */
+	int client_max_window_bits; /* 9-15, or 0 to let the server choose */
+	gboolean server_no_context_takeover;
+	gboolean client_no_context_takeover;
+	gboolean compress; /* compress outgoing messages too */
+} PurpleWebsocketDeflate;
+
+typedef struct _PurpleWebsocketStats {
+	/* Message payload bytes, as sent on the wire and before compression (the same without permessage-deflate) */
+	guint64 in_wire, in;
+	guint64 out_wire, out;
+	/* Times are from g_get_monotonic_time() (usec) */
+	gint64 last_in; /* when anything was last received (or the connection started) */
+	/* purple_websocket_ping round trips */
+	gint64 ping_sent; /* when the last ping was sent */
+	guint pings, pongs;
+	guint unanswered; /* pings sent since the last matching pong */
+	gint64 rtt, srtt, rtt_max; /* last, smoothed (as TCP's), and largest round trip times */
+} PurpleWebsocketStats;
+
+/* @param deflate permessage-deflate parameters to offer, or NULL for none */
+PurpleWebsocket *purple_websocket_connect(PurpleAccount *account, const char *url, const char *protocol, const char *cookies, const PurpleWebsocketDeflate *deflate, PurpleWebsocketCallback callback, void *user_data);
 void purple_websocket_send(PurpleWebsocket *ws, PurpleWebsocketOp op, const guchar *msg, size_t len);
 void purple_websocket_abort(PurpleWebsocket *ws);
+/* Deliver messages longer than about chunk bytes in pieces as they arrive, as any number of TEXT_PARTIAL (or BINARY_PARTIAL), then TEXT (or BINARY) with the rest (possibly empty),
+ * so that only about that much is ever buffered.  0 (the default) always delivers whole messages. */
+void purple_websocket_set_partial(PurpleWebsocket *ws, size_t chunk);
+const PurpleWebsocketStats *purple_websocket_stats(PurpleWebsocket *ws);
+/* Send a PING to time the round trip to its PONG (in stats).  Before the connection is open it's only counted as unanswered. */
+void purple_websocket_ping(PurpleWebsocket *ws);
 
 #endif
@@ -1,10 +1,14 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include <debug.h>
-#include <zlib.h>
 
+#include "slack-http.h"
 #include "slack-api.h"
 #include "slack-json.h"
 #include "slack-channel.h"
 #include "slack-user.h"
+#include "slack-rtm.h"
 
 PurpleConnectionError slack_api_connection_error(const gchar *error) {
 	if (!g_strcmp0(error, "not_authed"))
@@ -15,12 +19,157 @@ PurpleConnectionError slack_api_connection_error(const gchar *error) {
 	return PURPLE_CONNECTION_ERROR_NETWORK_ERROR;
 }
 
+/* Documented method rate limit tiers (https://api.slack.com/docs/rate-limits), in calls per minute, with some allowance for bursts */
+static const struct api_tier {
+	unsigned per_minute;
+	unsigned burst;
+} api_tiers[] = {
+	[0] = {   60, 10 }, /* special: chat.postMessage is roughly 1/sec */
+	[1] = {    1,  3 },
+	[2] = {   20, 20 },
+	[3] = {   50, 50 },
+	[4] = {  100, 100 },
+};
+
+#define API_TIER_DEFAULT 3
+
+static const struct {
+	const char *endpoint;
+	unsigned tier;
+} api_endpoint_tiers[] = {
+	{ "rtm.connect",		1 },
+	{ "users.list",			2 },
+	{ "users.setPresence",		2 },
+	{ "conversations.list",		2 },
+	{ "conversations.setTopic",	2 },
+	{ "conversations.members",	4 },
+	{ "users.info",			4 },
+	{ "chat.postMessage",		0 },
+	/* everything else we use is tier 3 (or undocumented) */
+};
+
+/* Methods that only read, so can be repeated if a connection fails (see slack_http_request).
+ * Everything else (chat.postMessage, conversations.mark, ...) might take effect twice. */
+static const char *const api_idempotent_methods[] = {
+	"list", "info", "history", "replies", "members", "counts",
+};
+
+static gboolean api_endpoint_idempotent(const char *endpoint) {
+	if (!strcmp(endpoint, "rtm.connect"))
+		return TRUE;
+	const char *method = strrchr(endpoint, '.');
+	if (method)
+		for (unsigned i = 0; i < G_N_ELEMENTS(api_idempotent_methods); i++)
+			if (!strcmp(method+1, api_idempotent_methods[i]))
+				return TRUE;
+	return FALSE;
+}
+
+/* Timing histograms: bucket i counts durations under 2^i ms, and the last everything longer */
+#define API_STATS_BUCKETS 16
+
+struct api_hist {
+	guint count;
+	gint64 total; /* usec */
+	guint buckets[API_STATS_BUCKETS];
+};
+
+enum api_stat {
+	API_STAT_QUEUE,    /* queued until sent */
+	API_STAT_NETWORK,  /* sent until response received (and decompressed) */
+	API_STAT_PARSE,    /* slack_json_parse */
+	API_STAT_CALLBACK, /* handling the response */
+	API_STATS
+};
+
+static const char *const api_stat_names[API_STATS] = { "queue", "network", "parse", "callback" };
+
+struct api_stats {
+	struct api_hist time[API_STATS];
+	guint64 request_bytes, response_bytes;
+	gsize response_max;
+};
+
+/* A token bucket (and statistics, when enabled) for each endpoint, in sa->api_limits */
+struct api_limit {
+	const struct api_tier *tier;
+	gboolean idempotent;
+	double tokens;
+	gint64 updated; /* monotonic time tokens was last refilled */
+	gint64 blocked; /* monotonic time until which we were told to wait (Retry-After) */
+	struct api_stats stats;
+};
+
+static struct api_limit *api_limit_get(SlackAccount *sa, const char *endpoint) {
+	struct api_limit *limit = g_hash_table_lookup(sa->api_limits, endpoint);
+	if (limit)
+		return limit;
+
+	unsigned tier = API_TIER_DEFAULT;
+	for (unsigned i = 0; i < G_N_ELEMENTS(api_endpoint_tiers); i++)
+		if (!strcmp(api_endpoint_tiers[i].endpoint, endpoint)) {
+			tier = api_endpoint_tiers[i].tier;
+			break;
+		}
+
+	limit = g_new0(struct api_limit, 1);
+	limit->tier = &api_tiers[tier];
+	limit->idempotent = api_endpoint_idempotent(endpoint);
+	limit->tokens = limit->tier->burst;
+	limit->updated = g_get_monotonic_time();
+	g_hash_table_insert(sa->api_limits, g_strdup(endpoint), limit);
+	return limit;
+}
+
+/* Take a token if one is available and return 0, or else return the (monotonic) time one will be */
+static gint64 api_limit_take(struct api_limit *limit, gint64 now) {
+	const double usec = 60 * G_USEC_PER_SEC;
+	limit->tokens = MIN(limit->tier->burst, limit->tokens + (now - limit->updated) * limit->tier->per_minute / usec);
+	limit->updated = now;
+	if (now < limit->blocked)
+		return limit->blocked;
+	if (limit->tokens >= 1) {
+		limit->tokens -= 1;
+		return 0;
+	}
+	return now + (gint64)((1 - limit->tokens) * usec / limit->tier->per_minute) + 1;
+}
+
+/* Only look at the clock if we're collecting statistics */
+static inline gint64 api_stats_now(SlackAccount *sa) {
+	return sa->api_stats ? g_get_monotonic_time() : 0;
+}
+
+static void api_stats_add(struct api_limit *limit, enum api_stat which, gint64 start, gint64 end) {
+	if (!start || !end)
+		return;
+	struct api_hist *h = &limit->stats.time[which];
+	gint64 d = end - start;
+	unsigned b = 0;
+	while (b < API_STATS_BUCKETS-1 && d >= ((gint64)1000 << b))
+		b++;
+	h->count++;
+	h->total += d;
+	h->buckets[b]++;
+}
+
+static void api_limit_block(struct api_limit *limit, unsigned seconds) {
+	gint64 now = g_get_monotonic_time();
+	limit->tokens = 0;
+	limit->updated = now;
+	limit->blocked = MAX(limit->blocked, now + (gint64)seconds * G_USEC_PER_SEC);
+}
+
 struct _SlackAPICall {
 	SlackAccount *sa;
 	char *url;
 	char *request;
-	PurpleUtilFetchUrlData *fetch;
-	guint timeout;
+	struct api_limit *limit;
+	const char *const *fields; /* only parse these (static) */
+	SlackAPIPriority priority; /* current lane in sa->api_calls */
+	gint64 queued; /* monotonic time it entered that lane */
+	gint64 created, started; /* monotonic times, for statistics only */
+	SlackHTTPRequest *http;
 	SlackAPICallback *callback;
 	gpointer data;
 };
@@ -32,58 +181,59 @@ static void api_free(SlackAPICall *call) {
 }
 
 static void api_error(SlackAPICall *call, const char *error) {
-	if (call->fetch)
-		purple_util_fetch_url_cancel(call->fetch);
-	if (call->timeout)
-		purple_timeout_remove(call->timeout);
+	SlackAccount *sa = call->sa;
+	if (call->http) {
+		slack_http_request_cancel(call->http);
+		sa->api_running--;
+	}
+	g_queue_remove(&sa->api_calls[call->priority], call);
 	if (call->callback)
-		call->callback(call->sa, call->data, NULL, error);
+		call->callback(sa, call->data, NULL, error);
 	api_free(call);
 };
 
-static gboolean api_retry(SlackAPICall *call);
 static void api_run(SlackAccount *sa);
-gchar *api_gunzip(const guchar *gzip_data, gsize *len_ptr);
 
-static void api_cb(PurpleUtilFetchUrlData *fetch, gpointer data, const gchar *buf_h, gsize len_h, const gchar *error) {
-	gboolean free_buf = FALSE;
-	SlackAccount *sa = data;
-	SlackAPICall *call = g_queue_pop_head(&sa->api_calls);
-	g_return_if_fail(call && (call->fetch == fetch || (call->fetch == NULL && error)));
-	call->fetch = NULL;
+static void api_cb(SlackHTTPRequest *http, gpointer data, const gchar *buf_h, gsize len_h, const gchar *error) {
+	SlackAPICall *call = data;
+	SlackAccount *sa = call->sa;
+	g_return_if_fail(call->http == http);
+	call->http = NULL;
+	sa->api_running--;
+
+	gint64 t_received = api_stats_now(sa);
+	api_stats_add(call->limit, API_STAT_NETWORK, call->started, t_received);
 
 	gsize len = len_h;
+	gsize len_headers = 0; /* fixed here, as len may not stay the raw body length */
 	const gchar *buf = g_strstr_len(buf_h, len_h, "\r\n\r\n");
 	if (buf) {
 		buf += 4; // skip the headers
-		len = len_h - (buf - buf_h);
+		len_headers = buf - buf_h;
+		len = len_h - len_headers;
 	} else {
 		buf = buf_h;
 		len = len_h;
 	}
 
-	if (g_strstr_len(buf_h, len_h - len, "Content-Encoding: gzip") != NULL ||
-			g_strstr_len(buf_h, len_h - len, "content-encoding: gzip") != NULL) {
-		gchar *gunzip = api_gunzip((const guchar *)buf, &len);
-		if (!gunzip) {
-			api_error(call, "Failed to gunzip response");
-			api_run(sa);
-			return;
-		}
-		free_buf = TRUE;
-		buf = gunzip;
-	}
-
+	/* body has already been decompressed as it arrived */
 	purple_debug_misc("slack", "api response: %s\n", error ?: buf);
 	if (error) {
-		if (free_buf) g_free((gchar *)buf);
 		api_error(call, error);
 		api_run(sa);
 		return;
 	}
 
-	json_value *json = json_parse(buf, len);
-	if (free_buf) g_free((gchar *)buf);
+	if (sa->api_stats) {
+		call->limit->stats.response_bytes += len;
+		call->limit->stats.response_max = MAX(call->limit->stats.response_max, len);
+	}
+
+	json_value *json = call->fields
+		? slack_json_parse_fields(buf, len, call->fields)
+		: slack_json_parse(buf, len);
+	gint64 t_parsed = api_stats_now(sa);
+	api_stats_add(call->limit, API_STAT_PARSE, t_received, t_parsed);
 	if (!json) {
 		api_error(call, "Invalid JSON response");
 		api_run(sa);
@@ -93,46 +243,128 @@ static void api_cb(PurpleUtilFetchUrlData *fetch, gpointer data, const gchar *bu
 	if (!json_get_prop_boolean(json, "ok", FALSE)) {
 		const char *err = json_get_prop_strptr(json, "error");
 		if (!g_strcmp0(err, "ratelimited")) {
-			/* #27: correct thing to do on 429 status is parse the "Retry-After" header and wait that many seconds,
-			 * but getting access to the headers here requires more work, so we just heuristically make up a number... */
-			g_queue_push_head(&sa->api_calls, call);
-			call->timeout = purple_timeout_add_seconds(purple_account_get_int(sa->account, "ratelimit_delay", 15), (GSourceFunc)api_retry, call);
-			json_value_free(json);
+			/* #27: wait as long as the 429 response's "Retry-After" says (or, failing that, make up a number).
+			 * The call keeps its place in the queue, and other endpoints may proceed meanwhile. */
+			const char *retry = slack_http_header(buf_h, len_headers, "Retry-After");
+			unsigned delay = retry ? strtoul(retry, NULL, 10) : 0;
+			if (!delay)
+				delay = purple_account_get_int(sa->account, "ratelimit_delay", 15);
+			purple_debug_info("slack", "ratelimited, delaying %s for %us\n", call->url, delay);
+			api_limit_block(call->limit, delay);
+			call->created = t_parsed;
+			slack_json_free(json);
+			api_run(sa);
 			return;
 		}
 		api_error(call, err ?: "Unknown error");
-		json_value_free(json);
+		slack_json_free(json);
 		api_run(sa);
 		return;
 	}
 
+	struct api_limit *limit = call->limit;
+	g_queue_remove(&sa->api_calls[call->priority], call);
 	if (call->callback)
 		if (call->callback(call->sa, call->data, json, NULL))
 			json = NULL;
 	if (json)
-		json_value_free(json);
+		slack_json_free(json);
 	api_free(call);
+	api_stats_add(limit, API_STAT_CALLBACK, t_parsed, api_stats_now(sa));
 	api_run(sa);
 }
 
-static gboolean api_retry(SlackAPICall *call) {
-	g_return_val_if_fail(call == g_queue_peek_head(&call->sa->api_calls), FALSE);
-	call->timeout = 0;
+/* maximum (decompressed) response size: big users.list pages can be large */
+#define API_MAX_RESPONSE (64*1024*1024)
+
+static inline guint api_window(SlackAccount *sa) {
+	return MAX(purple_account_get_int(sa->account, "api_concurrency", 4), 1);
+}
+
+/* How often to dump statistics to the debug log */
+#define API_STATS_INTERVAL 300
+
+static gboolean api_stats_timer_cb(gpointer data) {
+	SlackAccount *sa = data;
+	GString *out = g_string_new(NULL);
+	slack_api_stats(sa, out);
+	slack_rtm_stats(sa, out);
+	purple_debug_info("slack", "api statistics:\n%s", out->str);
+	g_string_free(out, TRUE);
+	return TRUE;
+}
+
+static void api_start(SlackAPICall *call) {
+	SlackAccount *sa = call->sa;
 	purple_debug_misc("slack", "api call: %s\n%s\n", call->url, call->request ?: "");
-	PurpleUtilFetchUrlData *fetch =
-		purple_util_fetch_url_request_len_with_account(call->sa->account,
-			call->url, TRUE, NULL, TRUE, call->request, TRUE, 4096*1024,
-			api_cb, call->sa);
-	if (fetch)
-		call->fetch = fetch;
+	if (sa->api_stats) {
+		call->started = g_get_monotonic_time();
+		api_stats_add(call->limit, API_STAT_QUEUE, call->created, call->started);
+		call->limit->stats.request_bytes += call->request ? strlen(call->request) : 0;
+		if (!sa->api_stats_timer)
+			sa->api_stats_timer = purple_timeout_add_seconds(API_STATS_INTERVAL, api_stats_timer_cb, sa);
+	}
+	call->http = slack_http_request(call->sa->http, call->url, call->request, call->limit->idempotent, api_window(call->sa), API_MAX_RESPONSE, api_cb, call);
+	if (call->http) {
+		call->sa->api_running++;
+		call->sa->api_count++;
+	} else
+		api_error(call, "Invalid API URL");
+}
+
+static gboolean api_timer_cb(gpointer data) {
+	SlackAccount *sa = data;
+	sa->api_timer = 0;
+	api_run(sa);
 	return FALSE;
 }
 
+/* Calls waiting this long in one lane move up to the next one, so nothing starves */
+#define API_AGE_USEC (10 * G_USEC_PER_SEC)
+
+static void api_age(SlackAccount *sa, gint64 now) {
+	for (unsigned p = 1; p < SLACK_API_PRIORITIES; p++) {
+		SlackAPICall *call;
+		while ((call = g_queue_peek_head(&sa->api_calls[p])) && now - call->queued >= API_AGE_USEC) {
+			g_queue_pop_head(&sa->api_calls[p]);
+			call->priority = p - 1;
+			call->queued = now;
+			g_queue_push_tail(&sa->api_calls[p - 1], call);
+		}
+	}
+}
+
 static void api_run(SlackAccount *sa) {
-	SlackAPICall *call = g_queue_peek_head(&sa->api_calls);
-	if (!call || call->fetch || call->timeout)
-		return;
-	api_retry(call);
+	/* start as many waiting calls (by priority, then in order) as the window and their endpoint limits allow */
+	guint window = api_window(sa);
+	gint64 now = g_get_monotonic_time();
+	gint64 wake = 0;
+	api_age(sa, now);
+	for (unsigned p = 0; p < SLACK_API_PRIORITIES && sa->api_running < window; p++) {
+		/* background work leaves a slot free for anything interactive that comes along */
+		guint lane_window = p >= SLACK_API_BACKGROUND && window > 1 ? window - 1 : window;
+		GList *l = sa->api_calls[p].head;
+		while (l && sa->api_running < lane_window) {
+			SlackAPICall *call = l->data;
+			l = l->next;
+			if (call->http)
+				continue;
+			gint64 ready = api_limit_take(call->limit, now);
+			if (ready) {
+				if (!wake || ready < wake)
+					wake = ready;
+				continue;
+			}
+			api_start(call);
+		}
+	}
+
+	if (sa->api_timer) {
+		purple_timeout_remove(sa->api_timer);
+		sa->api_timer = 0;
+	}
+	if (wake)
+		sa->api_timer = purple_timeout_add((wake - now + 999) / 1000, api_timer_cb, sa);
 }
 
 static char *slack_api_encode_post_request(SlackAccount *sa, const char *url, va_list qargs) {
@@ -167,7 +399,7 @@ Content-Disposition: form-data; name=\"%s\"\r\n\
 
 	request = g_string_new(NULL);
 	g_string_append_printf(request, "\
-POST /%s HTTP/1.0\r\n\
+POST /%s HTTP/1.1\r\n\
 Host: %s\r\n\
 Content-Type: multipart/form-data; boundary=---------------------------%" G_GUINT64_FORMAT "\r\n\
 Content-Length: %" G_GSIZE_FORMAT "\r\n",
@@ -187,116 +419,112 @@ Content-Length: %" G_GSIZE_FORMAT "\r\n",
 	return g_string_free(request, FALSE);
 }
 
-static void slack_api_call_url(SlackAccount *sa, SlackAPICallback callback, gpointer user_data, const char *url, const char *request) {
+static void slack_api_call_url(SlackAccount *sa, SlackAPIPriority priority, const char *const *fields, SlackAPICallback callback, gpointer user_data, const char *endpoint, const char *url, const char *request) {
 	SlackAPICall *call = g_new0(SlackAPICall, 1);
 	call->sa = sa;
+	call->fields = fields;
+	call->limit = api_limit_get(sa, endpoint);
+	call->priority = priority;
+	call->queued = g_get_monotonic_time();
+	call->created = sa->api_stats ? call->queued : 0;
 	call->callback = callback;
 	call->url = g_strdup(url);
 	call->request = g_strdup(request);
 	call->data = user_data;
 
-	gboolean empty = g_queue_is_empty(&sa->api_calls);
-	g_queue_push_tail(&sa->api_calls, call);
-	if (empty)
-		api_retry(call);
+	g_queue_push_tail(&sa->api_calls[priority], call);
+	api_run(sa);
 }
 
-void slack_api_post(SlackAccount *sa, SlackAPICallback callback, gpointer user_data, const gchar *endpoint, ...)
+static void slack_api_vpost(SlackAccount *sa, SlackAPIPriority priority, const char *const *fields, SlackAPICallback callback, gpointer user_data, const gchar *endpoint, va_list qargs)
 {
 	GString *url = g_string_new(NULL);
 	g_string_printf(url, "%s/%s", sa->api_url, endpoint);
 
-	va_list qargs;
-	va_start(qargs, endpoint);
 	char *request = slack_api_encode_post_request(sa, url->str, qargs);
-	va_end(qargs);
 
-	slack_api_call_url(sa, callback, user_data, url->str, request);
+	slack_api_call_url(sa, priority, fields, callback, user_data, endpoint, url->str, request);
 
 	g_string_free(url, TRUE);
   	g_free(request);
 }
 
-void slack_api_disconnect(SlackAccount *sa) {
-	SlackAPICall *call;
-	while ((call = g_queue_pop_head(&sa->api_calls)))
-		api_error(call, "disconnected");
+void slack_api_post(SlackAccount *sa, SlackAPICallback callback, gpointer user_data, const gchar *endpoint, ...)
+{
+	va_list qargs;
+	va_start(qargs, endpoint);
+	slack_api_vpost(sa, SLACK_API_INTERACTIVE, NULL, callback, user_data, endpoint, qargs);
+	va_end(qargs);
 }
 
-
-#include <zlib.h>
-
-gchar *
-api_gunzip(const guchar *gzip_data, gsize *len_ptr)
+void slack_api_post_priority(SlackAccount *sa, SlackAPIPriority priority, SlackAPICallback callback, gpointer user_data, const gchar *endpoint, ...)
 {
-	gsize gzip_data_len	= *len_ptr;
-	z_stream zstr;
-	int gzip_err = 0;
-	gchar *data_buffer;
-	gulong gzip_len = G_MAXUINT16;
-	GString *output_string = NULL;
-
-	data_buffer = g_new0(gchar, gzip_len);
-
-	zstr.next_in = NULL;
-	zstr.avail_in = 0;
-	zstr.zalloc = Z_NULL;
-	zstr.zfree = Z_NULL;
-	zstr.opaque = 0;
-	gzip_err = inflateInit2(&zstr, MAX_WBITS+32);
-	if (gzip_err != Z_OK)
-	{
-		g_free(data_buffer);
-		purple_debug_error("slack", "no built-in gzip support in zlib\n");
-		return NULL;
-	}
+	va_list qargs;
+	va_start(qargs, endpoint);
+	slack_api_vpost(sa, priority, NULL, callback, user_data, endpoint, qargs);
+	va_end(qargs);
+}
 
-	zstr.next_in = (Bytef *)gzip_data;
-	zstr.avail_in = gzip_data_len;
+void slack_api_post_fields(SlackAccount *sa, SlackAPIPriority priority, const char *const *fields, SlackAPICallback callback, gpointer user_data, const gchar *endpoint, ...)
+{
+	va_list qargs;
+	va_start(qargs, endpoint);
+	slack_api_vpost(sa, priority, fields, callback, user_data, endpoint, qargs);
+	va_end(qargs);
+}
 
-	zstr.next_out = (Bytef *)data_buffer;
-	zstr.avail_out = gzip_len;
+/* upper bound (in ms) on the given fraction of a histogram */
+static unsigned api_hist_percentile(const struct api_hist *h, double p) {
+	guint n = 0;
+	for (unsigned b = 0; b < API_STATS_BUCKETS-1; b++) {
+		n += h->buckets[b];
+		if (n >= p * h->count)
+			return 1 << b;
+	}
+	return 0; /* more than the last bucket */
+}
 
-	gzip_err = inflate(&zstr, Z_SYNC_FLUSH);
+void slack_api_stats(SlackAccount *sa, GString *out) {
+	if (!sa->api_stats) {
+		g_string_append(out, "API statistics are disabled (see the api_stats account option)\n");
+		return;
+	}
 
-	if (gzip_err == Z_DATA_ERROR)
-	{
-		inflateEnd(&zstr);
-		gzip_err = inflateInit2(&zstr, -MAX_WBITS);
-		if (gzip_err != Z_OK)
-		{
-			g_free(data_buffer);
-			purple_debug_error("slack", "Cannot decode gzip header\n");
-			return NULL;
+	g_string_append_printf(out, "%u API calls sent, %u running, %u lookups shared\n", sa->api_count, sa->api_running, sa->lookup_hits);
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, sa->api_limits);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		const struct api_stats *stats = &((struct api_limit *)value)->stats;
+		if (!stats->time[API_STAT_QUEUE].count)
+			continue;
+		g_string_append_printf(out, "%s: %u calls, %" G_GUINT64_FORMAT " bytes sent, %" G_GUINT64_FORMAT " bytes received (max %" G_GSIZE_FORMAT ")\n",
+				(const char *)key, stats->time[API_STAT_QUEUE].count, stats->request_bytes, stats->response_bytes, stats->response_max);
+		for (unsigned i = 0; i < API_STATS; i++) {
+			const struct api_hist *h = &stats->time[i];
+			if (!h->count)
+				continue;
+			unsigned p50 = api_hist_percentile(h, 0.5), p95 = api_hist_percentile(h, 0.95);
+			g_string_append_printf(out, "  %-8s avg %.1fms, 50%% %c%ums, 95%% %c%ums\n", api_stat_names[i],
+					h->total / (1000.0 * h->count),
+					p50 ? '<' : '>', p50 ?: 1 << (API_STATS_BUCKETS-2),
+					p95 ? '<' : '>', p95 ?: 1 << (API_STATS_BUCKETS-2));
 		}
-		zstr.next_in = (Bytef *)gzip_data;
-		zstr.avail_in = gzip_data_len;
-		zstr.next_out = (Bytef *)data_buffer;
-		zstr.avail_out = gzip_len;
-		gzip_err = inflate(&zstr, Z_SYNC_FLUSH);
 	}
-	output_string = g_string_new("");
-	while (gzip_err == Z_OK)
-	{
-		//append data to buffer
-		output_string = g_string_append_len(output_string, data_buffer, gzip_len - zstr.avail_out);
-		//reset buffer pointer
-		zstr.next_out = (Bytef *)data_buffer;
-		zstr.avail_out = gzip_len;
-		gzip_err = inflate(&zstr, Z_SYNC_FLUSH);
+}
+
+void slack_api_disconnect(SlackAccount *sa) {
+	SlackAPICall *call;
+	if (sa->api_timer) {
+		purple_timeout_remove(sa->api_timer);
+		sa->api_timer = 0;
 	}
-	if (gzip_err == Z_STREAM_END)
-	{
-		output_string = g_string_append_len(output_string, data_buffer, gzip_len - zstr.avail_out);
-	} else {
-		purple_debug_error("slack", "gzip inflate error\n");
+	if (sa->api_stats_timer) {
+		purple_timeout_remove(sa->api_stats_timer);
+		sa->api_stats_timer = 0;
 	}
-	inflateEnd(&zstr);
-
-	g_free(data_buffer);
-
-	if (len_ptr)
-		*len_ptr = output_string->len;
-
-	return g_string_free(output_string, FALSE);
+	for (unsigned p = 0; p < SLACK_API_PRIORITIES; p++)
+		while ((call = g_queue_peek_head(&sa->api_calls[p])))
+			api_error(call, "disconnected");
 }
+
@@ -8,10 +8,21 @@
 PurpleConnectionError slack_api_connection_error(const gchar *error);
 
 typedef struct _SlackAPICall SlackAPICall;
+/* Return TRUE to keep json (which must then be freed with slack_json_free) */
 typedef gboolean SlackAPICallback(SlackAccount *sa, gpointer user_data, json_value *json, const char *error);
 
+/* Queue an interactive API call */
 void slack_api_post(SlackAccount *sa, SlackAPICallback *callback, gpointer user_data, const char *endpoint, /* const char *query_param1, const char *query_value1, */ ...) G_GNUC_NULL_TERMINATED;
+/* Queue an API call in a specific priority lane */
+void slack_api_post_priority(SlackAccount *sa, SlackAPIPriority priority, SlackAPICallback *callback, gpointer user_data, const char *endpoint, ...) G_GNUC_NULL_TERMINATED;
+/* Queue an API call, and only parse the given response fields (see slack_json_parse_fields), which must include SLACK_API_FIELDS */
+void slack_api_post_fields(SlackAccount *sa, SlackAPIPriority priority, const char *const *fields, SlackAPICallback *callback, gpointer user_data, const char *endpoint, ...) G_GNUC_NULL_TERMINATED;
+
+/* Response fields used by the api itself, and for pagination */
+#define SLACK_API_FIELDS	"ok", "error", "response_metadata"
 void slack_api_disconnect(SlackAccount *sa);
+/* Append a per-endpoint summary of API timings and sizes (if api_stats is enabled) */
+void slack_api_stats(SlackAccount *sa, GString *out);
 
 #define SLACK_LIMIT_ARG(COUNT)		"limit", G_STRINGIFY(COUNT)
 
@@ -27,8 +27,7 @@ slack_auth_login_signin_cb(SlackAccount *sa, gpointer user_data, json_value *jso
 	/* now that we've signed in, we need to clear the values we overrode for
 	 * authentication and set them to the regular values.
 	 */
-	g_free(sa->api_url);
-	sa->api_url = g_strdup_printf("https://%s/api", sa->host);
+	slack_set_api_url(sa, sa->host);
 
 	slack_login_step(sa);
 	return FALSE;
@@ -37,7 +36,7 @@ slack_auth_login_signin_cb(SlackAccount *sa, gpointer user_data, json_value *jso
 static void
 slack_auth_login_user(SlackAccount *sa, const char *user_id) {
 	slack_login_step(sa);
-	slack_api_post(sa, slack_auth_login_signin_cb,
+	slack_api_post_priority(sa, SLACK_API_LOGIN, slack_auth_login_signin_cb,
 		NULL, "auth.signin",
 		"user", user_id,
 		"password", purple_account_get_password(sa->account),
@@ -81,7 +80,7 @@ slack_auth_login_findteam_cb(SlackAccount *sa, gpointer user_data, json_value *j
 	/* now validate that the user exists and get their ID. */
 	slack_login_step(sa);
 	if (strchr(sa->email, '@'))
-		slack_api_post(sa, slack_auth_login_finduser_cb,
+		slack_api_post_priority(sa, SLACK_API_LOGIN, slack_auth_login_finduser_cb,
 			NULL, "auth.findUser",
 			"email", sa->email,
 			"team", sa->team.id,
@@ -94,7 +93,7 @@ slack_auth_login_findteam_cb(SlackAccount *sa, gpointer user_data, json_value *j
 void
 slack_auth_login(SlackAccount *sa) {
 	/* validate the team and get it's ID */
-	slack_api_post(sa, slack_auth_login_findteam_cb,
+	slack_api_post_priority(sa, SLACK_API_LOGIN, slack_auth_login_findteam_cb,
 		NULL, "auth.findTeam",
 		"domain", sa->host,
 		NULL);
@@ -174,7 +174,7 @@ static gboolean roomlist_cb(SlackAccount *sa, gpointer data, json_value *json, c
 		purple_roomlist_room_add_field(expand->list, room, GUINT_TO_POINTER((gulong) json_get_val(json_get_prop(chan, "num_members"), integer, 0)));
 		time_t t = slack_parse_time(json_get_prop(chan, "created"));
 		purple_roomlist_room_add_field(expand->list, room, purple_date_format_long(localtime(&t)));
-		SlackUser *creator = (SlackUser*)slack_object_hash_table_lookup(sa->users, json_get_prop_strptr(chan, "creator"));
+		SlackUser *creator = (SlackUser*)slack_object_table_lookup(sa->users, json_get_prop_strptr(chan, "creator"));
 		purple_roomlist_room_add_field(expand->list, room, creator ? creator->object.name : NULL);
 		purple_roomlist_room_add(expand->list, room);
 	}
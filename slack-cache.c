@@ -0,0 +1,227 @@
+#include <string.h>
+#include <errno.h>
+
+#include <debug.h>
+#include <util.h>
+
+#include "slack-json.h"
+#include "slack-user.h"
+#include "slack-im.h"
+#include "slack-channel.h"
+#include "slack-blist.h"
+#include "slack-cache.h"
+
+/* The snapshot is json in the same shape as the users.list and conversations.list responses (with only the fields we use),
+ * so it goes through the same slack_user_update and slack_channel_set/slack_im_set as they do. */
+#define CACHE_VERSION 1 /* change to ignore old snapshots */
+
+static gboolean cache_enabled(SlackAccount *sa) {
+	return purple_account_get_bool(sa->account, "directory_cache", TRUE) &&
+		!purple_account_get_bool(sa->account, "lazy_load", FALSE);
+}
+
+static char *cache_file(SlackAccount *sa) {
+	char *name = g_strconcat(purple_escape_filename(purple_account_get_username(sa->account)), ".json", NULL);
+	char *file = g_build_filename(purple_user_dir(), "slack", name, NULL);
+	g_free(name);
+	return file;
+}
+
+/* Append a member (if val is set) to an object in progress */
+static void cache_string(GString *out, const char *key, const char *val) {
+	if (!val)
+		return;
+	if (out->str[out->len-1] != '{')
+		g_string_append_c(out, ',');
+	g_string_append_printf(out, "\"%s\":", key);
+	append_json_string(out, val);
+}
+
+static void cache_bool(GString *out, const char *key, gboolean val) {
+	if (out->str[out->len-1] != '{')
+		g_string_append_c(out, ',');
+	g_string_append_printf(out, "\"%s\":%s", key, val ? "true" : "false");
+}
+
+static void cache_users(SlackAccount *sa, GString *out) {
+	SlackObjectTableIter iter;
+	SlackUser *user;
+	slack_object_table_iter_init(&iter, sa->users);
+	while (slack_object_table_iter_next(&iter, (SlackObject**)&user)) {
+		if (!user->object.name)
+			continue;
+		g_string_append(out, "\n{");
+		cache_string(out, "id", user->object.id);
+		cache_string(out, "name", user->object.name);
+		g_string_append(out, ",\"profile\":{");
+		cache_string(out, "display_name", user->object.buddy ? purple_buddy_get_server_alias(user_buddy(user)) : NULL);
+		cache_string(out, "status_text", user->status);
+		cache_string(out, "avatar_hash", user->avatar_hash);
+		cache_string(out, "image_192", user->avatar_url);
+		g_string_append(out, "}},");
+	}
+}
+
+static void cache_conversations(SlackAccount *sa, GString *out) {
+	SlackObjectTableIter iter;
+	SlackChannel *chan;
+	slack_object_table_iter_init(&iter, sa->channels);
+	while (slack_object_table_iter_next(&iter, (SlackObject**)&chan)) {
+		g_string_append(out, "\n{");
+		cache_string(out, "id", chan->object.id);
+		cache_string(out, "name", chan->object.name);
+		switch (chan->type) {
+			case SLACK_CHANNEL_MPIM:
+				cache_bool(out, "is_mpim", TRUE);
+				break;
+			case SLACK_CHANNEL_GROUP:
+				cache_bool(out, "is_group", TRUE);
+				break;
+			case SLACK_CHANNEL_MEMBER:
+				cache_bool(out, "is_member", TRUE);
+				/* fall through */
+			default:
+				cache_bool(out, "is_channel", TRUE);
+		}
+		g_string_append(out, "},");
+	}
+
+	SlackUser *user;
+	slack_object_table_iter_init(&iter, sa->ims);
+	while (slack_object_table_iter_next(&iter, (SlackObject**)&user)) {
+		g_string_append(out, "\n{");
+		cache_string(out, "id", user->im);
+		cache_bool(out, "is_im", TRUE);
+		cache_string(out, "user", user->object.id);
+		cache_bool(out, "is_open", user->object.buddy != NULL);
+		g_string_append(out, "},");
+	}
+}
+
+/* replace the trailing comma of a list, if any, with its end */
+static void cache_list_end(GString *out) {
+	if (out->str[out->len-1] == ',')
+		g_string_truncate(out, out->len-1);
+	g_string_append_c(out, ']');
+}
+
+void slack_cache_save(SlackAccount *sa) {
+	if (!cache_enabled(sa) || !sa->team.id || !slack_login_directory_ready(sa))
+		return;
+
+	gint64 start = g_get_monotonic_time();
+	GString *out = g_string_sized_new(128 * (slack_object_table_size(sa->users) + slack_object_table_size(sa->channels) + slack_object_table_size(sa->ims)));
+	g_string_append_printf(out, "{\"version\":%d,\"team\":{", CACHE_VERSION);
+	cache_string(out, "id", sa->team.id);
+	cache_string(out, "name", sa->team.name);
+	cache_string(out, "domain", sa->team.domain);
+	g_string_append(out, "},\n\"members\":[");
+	cache_users(sa, out);
+	cache_list_end(out);
+	g_string_append(out, ",\n\"channels\":[");
+	cache_conversations(sa, out);
+	cache_list_end(out);
+	g_string_append(out, "}\n");
+
+	char *file = cache_file(sa);
+	char *dir = g_path_get_dirname(file);
+	GError *err = NULL;
+	if (g_mkdir_with_parents(dir, 0700) || !g_file_set_contents(file, out->str, out->len, &err)) {
+		purple_debug_error("slack", "could not save snapshot %s: %s\n", file, err ? err->message : g_strerror(errno));
+		if (err)
+			g_error_free(err);
+	} else
+		purple_debug_info("slack", "saved snapshot of %u users, %u channels, %u IMs (%lu bytes) in %.3fs\n",
+				slack_object_table_size(sa->users), slack_object_table_size(sa->channels), slack_object_table_size(sa->ims), (unsigned long)out->len,
+				(g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+	g_free(dir);
+	g_free(file);
+	g_string_free(out, TRUE);
+}
+
+gboolean slack_cache_load(SlackAccount *sa) {
+	if (!cache_enabled(sa))
+		return FALSE;
+
+	gint64 start = g_get_monotonic_time();
+	char *file = cache_file(sa);
+	GError *err = NULL;
+	GMappedFile *map = g_mapped_file_new(file, FALSE, &err);
+	if (!map) {
+		purple_debug_info("slack", "no snapshot: %s\n", err->message);
+		g_error_free(err);
+		g_free(file);
+		return FALSE;
+	}
+	json_value *json = slack_json_parse(g_mapped_file_get_contents(map), g_mapped_file_get_length(map));
+	g_mapped_file_unref(map);
+
+	json_value *team = json_get_prop_type(json, "team", object);
+	json_value *members = json_get_prop_type(json, "members", array);
+	json_value *chans = json_get_prop_type(json, "channels", array);
+	const char *team_id = json_get_prop_strptr(team, "id");
+	if (json_get_prop_val(json, "version", integer, 0) != CACHE_VERSION || !team_id || !members || !chans ||
+			(sa->team.id && strcmp(sa->team.id, team_id))) {
+		purple_debug_warning("slack", "ignoring unusable snapshot %s\n", file);
+		slack_json_free(json);
+		g_free(file);
+		return FALSE;
+	}
+	g_free(file);
+
+	/* rtm.connect will have the latest, but this is enough for the buddy list */
+#define SET_STR(FIELD, PROP) \
+	if (!sa->team.FIELD) \
+		sa->team.FIELD = g_strdup(json_get_prop_strptr(team, PROP))
+	SET_STR(id, "id");
+	SET_STR(name, "name");
+	SET_STR(domain, "domain");
+#undef SET_STR
+	slack_blist_init(sa);
+
+	for (unsigned i = 0; i < members->u.array.length; i++)
+		slack_user_update(sa, members->u.array.values[i]);
+
+	sa->cache_stale = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (unsigned i = 0; i < chans->u.array.length; i++) {
+		json_value *chan = chans->u.array.values[i];
+		SlackObject *conv = json_get_prop_boolean(chan, "is_im", FALSE)
+			? (SlackObject *)slack_im_set(sa, chan, NULL, TRUE, FALSE)
+			: (SlackObject *)slack_channel_set(sa, chan, SLACK_CHANNEL_UNKNOWN);
+		if (conv)
+			g_hash_table_add(sa->cache_stale, g_strdup(json_get_prop_strptr(chan, "id")));
+	}
+	slack_json_free(json);
+
+	sa->login_cached = TRUE;
+	purple_debug_info("slack", "loaded snapshot of %u users, %u channels, %u IMs in %.3fs\n",
+			slack_object_table_size(sa->users), slack_object_table_size(sa->channels), slack_object_table_size(sa->ims),
+			(g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+	return TRUE;
+}
+
+void slack_cache_seen(SlackAccount *sa, const char *id) {
+	if (sa->cache_stale && id)
+		g_hash_table_remove(sa->cache_stale, id);
+}
+
+void slack_cache_revalidated(SlackAccount *sa) {
+	if (!sa->cache_stale)
+		return;
+
+	GHashTableIter iter;
+	char *id;
+	g_hash_table_iter_init(&iter, sa->cache_stale);
+	while (g_hash_table_iter_next(&iter, (gpointer*)&id, NULL)) {
+		purple_debug_info("slack", "snapshot conversation %s is gone\n", id);
+		json_value sid = { .type = json_string, .u.string = { strlen(id), id } };
+		if (slack_object_table_lookup(sa->ims, id))
+			slack_im_set(sa, &sid, NULL, FALSE, TRUE);
+		else
+			slack_channel_set(sa, &sid, SLACK_CHANNEL_DELETED);
+	}
+	g_hash_table_destroy(sa->cache_stale);
+	sa->cache_stale = NULL;
+	purple_debug_info("slack", "snapshot revalidated at %.3fs\n",
+			(g_get_monotonic_time() - sa->login_start) / (double)G_USEC_PER_SEC);
+}
@@ -0,0 +1,19 @@
+#ifndef _PURPLE_SLACK_CACHE_H
+#define _PURPLE_SLACK_CACHE_H
+
+#include "slack.h"
+
+/* A snapshot of the team's users and conversations, saved between sessions so login doesn't have to wait for users.list and conversations.list */
+
+/* Load the snapshot (if enabled and there is one) into sa->users, sa->channels, and sa->ims, setting sa->login_cached.
+ * The lists are still loaded afterwards, to bring it up to date (see slack_cache_seen, slack_cache_revalidated). */
+gboolean slack_cache_load(SlackAccount *sa);
+/* Save the snapshot, if everything has been loaded */
+void slack_cache_save(SlackAccount *sa);
+
+/* Note a conversation from conversations.list, so it's kept */
+void slack_cache_seen(SlackAccount *sa, const char *id);
+/* Everything has been loaded: drop conversations from the snapshot that conversations.list no longer has (archived or left) */
+void slack_cache_revalidated(SlackAccount *sa);
+
+#endif // _PURPLE_SLACK_CACHE_H
@@ -58,7 +58,7 @@ SlackChannel *slack_channel_set(SlackAccount *sa, json_value *json, SlackChannel
 	slack_object_id id;
 	slack_object_id_set(id, sid);
 
-	SlackChannel *chan = g_hash_table_lookup(sa->channels, id);
+	SlackChannel *chan = (SlackChannel*)slack_object_table_lookup(sa->channels, id);
 
 	if      (json_get_prop_boolean(json, "is_archived", FALSE))
 		type = SLACK_CHANNEL_DELETED;
@@ -77,7 +77,7 @@ SlackChannel *slack_channel_set(SlackAccount *sa, json_value *json, SlackChannel
 		channel_depart(sa, chan);
 		if (chan->object.name)
 			g_hash_table_remove(sa->channel_names, chan->object.name);
-		g_hash_table_remove(sa->channels, id);
+		slack_object_table_remove(sa->channels, id);
 		return NULL;
 	}
 
@@ -86,7 +86,7 @@ SlackChannel *slack_channel_set(SlackAccount *sa, json_value *json, SlackChannel
 	if (!chan) {
 		chan = g_object_new(SLACK_TYPE_CHANNEL, NULL);
 		slack_object_id_copy(chan->object.id, id);
-		g_hash_table_replace(sa->channels, chan->object.id, chan);
+		slack_object_table_replace(sa->channels, &chan->object);
 	}
 
 	if (type > SLACK_CHANNEL_UNKNOWN)
@@ -162,7 +162,7 @@ static gboolean channels_members_cb(SlackAccount *sa, gpointer data, json_value
 	if (members) {
 		GList *users = NULL, *flags = NULL;
 		for (unsigned i = members->u.array.length; i; i --) {
-			SlackUser *user = (SlackUser*)slack_object_hash_table_lookup(sa->users, json_get_strptr(members->u.array.values[i-1]));
+			SlackUser *user = (SlackUser*)slack_object_table_lookup(sa->users, json_get_strptr(members->u.array.values[i-1]));
 			if (!user)
 				continue;
 			users = g_list_prepend(users, user->object.name);
@@ -179,7 +179,7 @@ static gboolean channels_members_cb(SlackAccount *sa, gpointer data, json_value
 	json_value *metadata = json_get_prop_type(json, "response_metadata", object);
 	char *next_cursor = json_get_prop_strptr(metadata, "next_cursor");
 	if (strcmp(next_cursor, "")) {
-		slack_api_post(sa, channels_members_cb, chan, "conversations.members", "channel", chan->object.id, "cursor", next_cursor, NULL);
+		slack_api_post_priority(sa, SLACK_API_BACKGROUND, channels_members_cb, chan, "conversations.members", "channel", chan->object.id, "cursor", next_cursor, NULL);
 	}
 
 	return FALSE;
@@ -201,12 +201,12 @@ static gboolean channels_info_cb(SlackAccount *sa, gpointer data, json_value *js
 
 	json_value *topic = json_get_prop_type(json, "topic", object);
 	if (topic) {
-		SlackUser *topic_user = (SlackUser*)slack_object_hash_table_lookup(sa->users, json_get_prop_strptr(topic, "creator"));
+		SlackUser *topic_user = (SlackUser*)slack_object_table_lookup(sa->users, json_get_prop_strptr(topic, "creator"));
 		purple_conv_chat_set_topic(conv, topic_user ? topic_user->object.name : NULL, json_get_prop_strptr(json, "value"));
 	}
 
 	if (purple_account_get_bool(sa->account, "channel_members", TRUE))
-		slack_api_post(sa, channels_members_cb, chan, "conversations.members", "channel", chan->object.id, NULL);
+		slack_api_post_priority(sa, SLACK_API_BACKGROUND, channels_members_cb, chan, "conversations.members", "channel", chan->object.id, NULL);
 
 	if (purple_account_get_bool(sa->account, "open_history", FALSE)) {
 		slack_get_history_unread(sa, &chan->object, json);
@@ -342,6 +342,9 @@ int slack_channel_send(SlackAccount *sa, SlackChannel *chan, const char *msg, Pu
 	if (thread)
 		slack_api_post(sa, send_chat_api_cb, send, "chat.postMessage", "channel", chan->object.id, "text", m,
 				"thread_ts", thread, "as_user", "true", NULL);
+	else if (!sa->rtm) /* reconnecting */
+		slack_api_post(sa, send_chat_api_cb, send, "chat.postMessage", "channel", chan->object.id, "text", m,
+				"as_user", "true", NULL);
 	else {
 		GString *channel = append_json_string(g_string_new(NULL), chan->object.id);
 		GString *text = append_json_string(g_string_new(NULL), m);
@@ -365,7 +368,7 @@ int slack_chat_send(PurpleConnection *gc, int cid, const char *msg, PurpleMessag
 }
 
 void slack_member_joined_channel(SlackAccount *sa, json_value *json, gboolean joined) {
-	SlackChannel *chan = (SlackChannel*)slack_object_hash_table_lookup(sa->channels, json_get_prop_strptr(json, "channel"));
+	SlackChannel *chan = (SlackChannel*)slack_object_table_lookup(sa->channels, json_get_prop_strptr(json, "channel"));
 	if (!chan)
 		return;
 
@@ -374,7 +377,7 @@ void slack_member_joined_channel(SlackAccount *sa, json_value *json, gboolean jo
 		return;
 
 	const char *user_id = json_get_prop_strptr(json, "user");
-	SlackUser *user = (SlackUser*)slack_object_hash_table_lookup(sa->users, user_id);
+	SlackUser *user = (SlackUser*)slack_object_table_lookup(sa->users, user_id);
 	if (joined) {
 		PurpleConvChatBuddyFlags flag = PURPLE_CBFLAGS_VOICE;
 		/* TODO we don't know creator here */
@@ -6,6 +6,7 @@
 #include "slack-conversation.h"
 #include "slack-cmd.h"
 #include "slack-thread.h"
+#include "slack-rtm.h"
 
 /* really most commands are handled server-side, but OPT_PROTO_SLACK_COMMANDS_NATIVE doesn't quite work right (when the same command is registered for other things), so we defensively register a trivial handler for at least all the builtin commands.
  * copied from https://get.slack.help/hc/en-us/articles/201259356-using-slash-commands */
@@ -158,6 +159,25 @@ static PurpleCmdRet cmd_getthread(PurpleConversation *conv, const gchar *cmd, gc
 	return PURPLE_CMD_RET_OK;
 }
 
+static PurpleCmdRet cmd_slackstats(PurpleConversation *conv, const gchar *cmd, gchar **args, gchar **error, void *data) {
+	SlackAccount *sa = get_slack_account(conv->account);
+	if (!sa)
+		return PURPLE_CMD_RET_FAILED;
+
+	GString *out = g_string_new(NULL);
+	slack_api_stats(sa, out);
+	slack_rtm_stats(sa, out);
+	/* it's plain text, with < and > in it */
+	gchar *escaped = g_markup_escape_text(out->str, out->len);
+	gchar *html = purple_strreplace(escaped, "\n", "<br>");
+	g_free(escaped);
+	purple_conversation_write(conv, NULL, html, PURPLE_MESSAGE_SYSTEM | PURPLE_MESSAGE_NO_LOG, time(NULL));
+	g_free(html);
+	g_string_free(out, TRUE);
+
+	return PURPLE_CMD_RET_OK;
+}
+
 static GSList *commands = NULL;
 
 void slack_cmd_register() {
@@ -192,6 +212,10 @@ void slack_cmd_register() {
 			SLACK_PLUGIN_ID, cmd_delete, "delete: remove your last message", NULL);
 	commands = g_slist_prepend(commands, GUINT_TO_POINTER(id));
 
+	id = purple_cmd_register("slackstats", "", PURPLE_CMD_P_PRPL, PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_PRPL_ONLY,
+			SLACK_PLUGIN_ID, cmd_slackstats, "slackstats: show API request (if api_stats is enabled) and RTM event statistics", NULL);
+	commands = g_slist_prepend(commands, GUINT_TO_POINTER(id));
+
 	static const char *thread_cmds[] = {"thread", "th", NULL};
 	for (cmdp = thread_cmds; *cmdp; cmdp++) {
 		id = purple_cmd_register(*cmdp, "s", PURPLE_CMD_P_PRPL, PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_PRPL_ONLY,
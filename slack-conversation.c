@@ -7,6 +7,7 @@
 #include "slack-im.h"
 #include "slack-message.h"
 #include "slack-conversation.h"
+#include "slack-cache.h"
 
 static SlackObject *conversation_update(SlackAccount *sa, json_value *json) {
 	if (json_get_prop_boolean(json, "is_im", FALSE))
@@ -15,8 +16,25 @@ static SlackObject *conversation_update(SlackAccount *sa, json_value *json) {
 		return (SlackObject*)slack_channel_set(sa, json, SLACK_CHANNEL_UNKNOWN);
 }
 
+/* everything conversation_update (slack_channel_set, slack_im_set) looks at */
+static const char *const conversations_list_fields[] = {
+	SLACK_API_FIELDS,
+	"channels.id",
+	"channels.name",
+	"channels.user",
+	"channels.is_im",
+	"channels.is_open",
+	"channels.is_archived",
+	"channels.is_mpim",
+	"channels.is_group",
+	"channels.is_member",
+	"channels.is_general",
+	"channels.is_channel",
+	NULL
+};
+
 #define CONVERSATIONS_LIST_CALL(sa, ARGS...) \
-	slack_api_post(sa, conversations_list_cb, NULL, "conversations.list", "types", "public_channel,private_channel,mpim,im", "exclude_archived", "true", SLACK_PAGINATE_LIMIT_ARG, ##ARGS, NULL)
+	slack_api_post_fields(sa, SLACK_API_DIRECTORY(sa), conversations_list_fields, conversations_list_cb, NULL, "conversations.list", "types", "public_channel,private_channel,mpim,im", "exclude_archived", "true", SLACK_PAGINATE_LIMIT_ARG, ##ARGS, NULL)
 
 static gboolean conversations_list_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
 	json_value *chans = json_get_prop_type(json, "channels", array);
@@ -26,15 +44,34 @@ static gboolean conversations_list_cb(SlackAccount *sa, gpointer data, json_valu
 		return FALSE;
 	}
 
-	for (unsigned i = 0; i < chans->u.array.length; i++)
-		conversation_update(sa, chans->u.array.values[i]);
-
+	/* IMs need their users, and everything needs the buddy list, so pages may have to wait for those */
+	g_queue_push_tail(&sa->login_conversations, json);
 	char *cursor = json_get_prop_strptr(json_get_prop(json, "response_metadata"), "next_cursor");
 	if (cursor && *cursor)
 		CONVERSATIONS_LIST_CALL(sa, "cursor", cursor);
 	else
-		slack_login_step(sa);
-	return FALSE;
+		g_queue_push_tail(&sa->login_conversations, NULL);
+	slack_conversations_flush(sa);
+	return TRUE;
+}
+
+void slack_conversations_flush(SlackAccount *sa) {
+	if (!slack_login_is_done(sa, SLACK_LOGIN_USERS) || !slack_login_is_done(sa, SLACK_LOGIN_RTM_CONNECT))
+		return;
+
+	while (!g_queue_is_empty(&sa->login_conversations)) {
+		json_value *json = g_queue_pop_head(&sa->login_conversations);
+		if (!json) {
+			slack_login_done(sa, SLACK_LOGIN_CONVERSATIONS);
+			return;
+		}
+		json_value *chans = json_get_prop_type(json, "channels", array);
+		for (unsigned i = 0; i < chans->u.array.length; i++) {
+			conversation_update(sa, chans->u.array.values[i]);
+			slack_cache_seen(sa, json_get_prop_strptr(chans->u.array.values[i], "id"));
+		}
+		slack_json_free(json);
+	}
 }
 
 void slack_conversations_load(SlackAccount *sa) {
@@ -95,13 +132,13 @@ static gboolean conversation_counts_cb(SlackAccount *sa, gpointer data, json_val
 	conversation_counts_channels(sa, json, "groups", SLACK_CHANNEL_GROUP, load_history);
 	conversation_counts_channels(sa, json, "mpims", SLACK_CHANNEL_MPIM, load_history);
 
-	slack_login_step(sa);
+	slack_login_done(sa, SLACK_LOGIN_COUNTS);
 	return FALSE;
 }
 
 void slack_conversation_counts(SlackAccount *sa) {
 	/* Private API, not documented. Found by EionRobb (Github). */
-	slack_api_post(sa, conversation_counts_cb, NULL, "users.counts", "mpim_aware", "true", "only_relevant_ims", "true", "simple_unreads", "true", NULL);
+	slack_api_post_priority(sa, SLACK_API_LOGIN, conversation_counts_cb, NULL, "users.counts", "mpim_aware", "true", "only_relevant_ims", "true", "simple_unreads", "true", NULL);
 }
 
 SlackObject *slack_conversation_get_conversation(SlackAccount *sa, PurpleConversation *conv) {
@@ -115,18 +152,35 @@ SlackObject *slack_conversation_get_conversation(SlackAccount *sa, PurpleConvers
 	}
 }
 
-struct conversation_retrieve {
+struct conversation_retrieve_waiter {
 	SlackConversationCallback *cb;
 	gpointer data;
+};
+
+/* A pending conversations.info lookup, in sa->conversation_lookups */
+struct conversation_retrieve {
+	slack_object_id id;
+	GSList *waiters; /* struct conversation_retrieve_waiter, newest first */
 	json_value *json;
 };
 
+static void conversation_retrieve_done(SlackAccount *sa, struct conversation_retrieve *lookup, SlackObject *obj) {
+	g_hash_table_remove(sa->conversation_lookups, lookup->id);
+	GSList *waiters = g_slist_reverse(lookup->waiters);
+	for (GSList *l = waiters; l; l = l->next) {
+		struct conversation_retrieve_waiter *w = l->data;
+		w->cb(sa, w->data, obj);
+	}
+	g_slist_free_full(waiters, g_free);
+	g_free(lookup);
+}
+
 static void conversation_retrieve_user_cb(SlackAccount *sa, gpointer data, SlackUser *user) {
 	struct conversation_retrieve *lookup = data;
 	json_value *chan = json_get_prop_type(lookup->json, "channel", object);
-	lookup->cb(sa, lookup->data, conversation_update(sa, chan));
-	json_value_free(lookup->json);
-	g_free(lookup);
+	SlackObject *obj = conversation_update(sa, chan);
+	slack_json_free(lookup->json);
+	conversation_retrieve_done(sa, lookup, obj);
 }
 
 static gboolean conversation_retrieve_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
@@ -134,8 +188,7 @@ static gboolean conversation_retrieve_cb(SlackAccount *sa, gpointer data, json_v
 	json_value *chan = json_get_prop_type(json, "channel", object);
 	if (!chan || error) {
 		purple_debug_error("slack", "Error retrieving conversation: %s\n", error ?: "missing");
-		lookup->cb(sa, lookup->data, NULL);
-		g_free(lookup);
+		conversation_retrieve_done(sa, lookup, NULL);
 		return FALSE;
 	}
 	lookup->json = json;
@@ -155,29 +208,79 @@ void slack_conversation_retrieve(SlackAccount *sa, const char *sid, SlackConvers
 	SlackObject *obj = slack_conversation_lookup_sid(sa, sid);
 	if (obj)
 		return cb(sa, data, obj);
-	struct conversation_retrieve *lookup = g_new(struct conversation_retrieve, 1);
-	lookup->cb = cb;
-	lookup->data = data;
-	slack_api_post(sa, conversation_retrieve_cb, lookup, "conversations.info", "channel", sid, NULL);
+
+	struct conversation_retrieve_waiter *w = g_new(struct conversation_retrieve_waiter, 1);
+	w->cb = cb;
+	w->data = data;
+
+	/* only one conversations.info per conversation at a time: later callers wait on the same response */
+	slack_object_id id;
+	slack_object_id_set(id, sid);
+	struct conversation_retrieve *lookup = g_hash_table_lookup(sa->conversation_lookups, id);
+	if (lookup) {
+		sa->lookup_hits++;
+		lookup->waiters = g_slist_prepend(lookup->waiters, w);
+		return;
+	}
+	sa->lookup_misses++;
+
+	lookup = g_new0(struct conversation_retrieve, 1);
+	slack_object_id_copy(lookup->id, id);
+	lookup->waiters = g_slist_prepend(NULL, w);
+	g_hash_table_insert(sa->conversation_lookups, lookup->id, lookup);
+	slack_api_post_priority(sa, SLACK_API_BACKGROUND, conversation_retrieve_cb, lookup, "conversations.info", "channel", sid, NULL);
+}
+
+static void mark_conversation_send(SlackAccount *sa);
+
+static gboolean mark_conversation_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
+	SlackObject *obj = data;
+	if (error)
+		purple_debug_error("slack", "Error marking %s: %s\n", obj->name ?: obj->id, error);
+	gboolean sending = sa->mark_sending == obj;
+	g_object_unref(obj);
+	if (sending) {
+		/* otherwise we're disconnecting (and it's been saved) */
+		sa->mark_sending = NULL;
+		mark_conversation_send(sa);
+	}
+	return FALSE;
+}
+
+/* Send the next pending mark, one at a time, in the background */
+static void mark_conversation_send(SlackAccount *sa) {
+	if (sa->mark_sending || sa->mark_timer || sa->mark_list == MARK_LIST_END)
+		return;
+
+	SlackObject *obj = sa->mark_list;
+	sa->mark_list = obj->mark_next;
+	obj->mark_next = NULL;
+	g_free(obj->last_mark);
+	obj->last_mark = g_strdup(obj->last_read);
+	sa->mark_sending = g_object_ref(obj);
+	slack_api_post_priority(sa, SLACK_API_BACKGROUND, mark_conversation_cb, obj, "conversations.mark", "channel", slack_conversation_id(obj), "ts", obj->last_mark, NULL);
 }
 
 static gboolean mark_conversation_timer(gpointer data) {
 	SlackAccount *sa = data;
 	sa->mark_timer = 0; /* always return FALSE */
+	mark_conversation_send(sa);
+	return FALSE;
+}
 
-	/* we just send them all at once -- maybe would be better to chain? */
-	SlackObject *next = sa->mark_list;
-	sa->mark_list = MARK_LIST_END;
-	while (next != MARK_LIST_END) {
-		SlackObject *obj = next;
-		next = obj->mark_next;
-		obj->mark_next = NULL;
-		g_free(obj->last_mark);
-		obj->last_mark = g_strdup(obj->last_read);
-		slack_api_post(sa, NULL, NULL, "conversations.mark", "channel", slack_conversation_id(obj), "ts", obj->last_mark, NULL);
-	}
+static void mark_conversation_add(SlackAccount *sa, SlackObject *obj) {
+	if (obj->mark_next)
+		return; /* already on list (and will send latest last_read) */
 
-	return FALSE;
+	/* add to list */
+	obj->mark_next = sa->mark_list;
+	sa->mark_list = obj;
+
+	if (sa->mark_timer)
+		return; /* already running */
+
+	/* start: wait a bit so repeated marks of the same conversation are merged */
+	sa->mark_timer = purple_timeout_add_seconds(5, mark_conversation_timer, sa);
 }
 
 void slack_mark_conversation(SlackAccount *sa, PurpleConversation *conv) {
@@ -195,18 +298,71 @@ void slack_mark_conversation(SlackAccount *sa, PurpleConversation *conv) {
 	g_free(obj->last_read);
 	obj->last_read = g_strdup(obj->last_mesg);
 
-	if (obj->mark_next)
-		return; /* already on list */
+	mark_conversation_add(sa, obj);
+}
 
-	/* add to list */
-	obj->mark_next = sa->mark_list;
-	sa->mark_list = obj;
+/* Unsent marks are saved in the account as "id:ts id:ts ..." */
+#define MARKS_SETTING "pending_marks"
 
-	if (sa->mark_timer)
-		return; /* already running */
+void slack_marks_save(SlackAccount *sa) {
+	if (sa->mark_timer) {
+		purple_timeout_remove(sa->mark_timer);
+		sa->mark_timer = 0;
+	}
 
-	/* start */
-	sa->mark_timer = purple_timeout_add_seconds(5, mark_conversation_timer, sa);
+	/* keep anything saved last time that we never got to load */
+	GString *marks = g_string_new(purple_account_get_string(sa->account, MARKS_SETTING, NULL));
+	if (marks->len)
+		g_string_append_c(marks, ' ');
+	if (sa->mark_sending) {
+		/* we can't know if this one made it, but re-sending a mark is harmless */
+		SlackObject *obj = sa->mark_sending;
+		g_string_append_printf(marks, "%s:%s ", slack_conversation_id(obj), obj->last_mark);
+		sa->mark_sending = NULL;
+	}
+	while (sa->mark_list != MARK_LIST_END) {
+		SlackObject *obj = sa->mark_list;
+		sa->mark_list = obj->mark_next;
+		obj->mark_next = NULL;
+		const char *id = slack_conversation_id(obj);
+		if (id && obj->last_read)
+			g_string_append_printf(marks, "%s:%s ", id, obj->last_read);
+	}
+
+	if (marks->len) {
+		g_string_truncate(marks, marks->len-1);
+		purple_debug_info("slack", "saving unsent marks: %s\n", marks->str);
+		purple_account_set_string(sa->account, MARKS_SETTING, marks->str);
+	} else
+		purple_account_remove_setting(sa->account, MARKS_SETTING);
+	g_string_free(marks, TRUE);
+}
+
+void slack_marks_load(SlackAccount *sa) {
+	const char *saved = purple_account_get_string(sa->account, MARKS_SETTING, NULL);
+	if (!saved || !*saved)
+		return;
+
+	gchar **marks = g_strsplit(saved, " ", 0);
+	purple_account_remove_setting(sa->account, MARKS_SETTING);
+	for (gchar **m = marks; *m; m++) {
+		char *ts = strchr(*m, ':');
+		if (!ts)
+			continue;
+		*ts++ = 0;
+		SlackObject *obj = slack_conversation_lookup_sid(sa, *m);
+		if (!obj) {
+			/* not loaded (lazy_load): just send it */
+			slack_api_post_priority(sa, SLACK_API_BACKGROUND, NULL, NULL, "conversations.mark", "channel", *m, "ts", ts, NULL);
+			continue;
+		}
+		if (slack_ts_cmp(ts, obj->last_read) <= 0)
+			continue; /* already read further (elsewhere) */
+		g_free(obj->last_read);
+		obj->last_read = g_strdup(ts);
+		mark_conversation_add(sa, obj);
+	}
+	g_strfreev(marks);
 }
 
 struct get_history {
@@ -214,6 +370,7 @@ struct get_history {
 	char *since;
 	gboolean thread;
 	gboolean force_threads;
+	SlackAPIPriority priority; /* for the threads it finds too */
 };
 
 void slack_get_history_free(struct get_history *h) {
@@ -253,7 +410,7 @@ static gboolean get_history_cb(SlackAccount *sa, gpointer data, json_value *json
 				if (display_threads) {
 					const char *latest_reply = json_get_prop_strptr(msg, "latest_reply");
 					if (!latest_reply || !h->since || slack_ts_cmp(latest_reply, h->since) > 0)
-						slack_get_history(sa, h->conv, h->since, SLACK_HISTORY_LIMIT_COUNT, thread_ts, FALSE);
+						slack_get_history_priority(sa, h->priority, h->conv, h->since, SLACK_HISTORY_LIMIT_COUNT, thread_ts, FALSE);
 				}
 			}
 
@@ -268,6 +425,12 @@ static gboolean get_history_cb(SlackAccount *sa, gpointer data, json_value *json
 }
 
 void slack_get_history(SlackAccount *sa, SlackObject *conv, const char *since, unsigned count, const char *thread_ts, gboolean force_threads) {
+	/* history fetched while connecting (connect_history) shouldn't get in the way of anything else */
+	SlackAPIPriority priority = purple_connection_get_state(sa->gc) == PURPLE_CONNECTED ? SLACK_API_INTERACTIVE : SLACK_API_BULK;
+	slack_get_history_priority(sa, priority, conv, since, count, thread_ts, force_threads);
+}
+
+void slack_get_history_priority(SlackAccount *sa, SlackAPIPriority priority, SlackObject *conv, const char *since, unsigned count, const char *thread_ts, gboolean force_threads) {
 	purple_debug_misc("slack", "get_history %s %u\n", since, count);
 
 	if (count == 0)
@@ -295,6 +458,7 @@ void slack_get_history(SlackAccount *sa, SlackObject *conv, const char *since, u
 	h->since = g_strdup(since);
 	h->thread = (thread_ts != NULL);
 	h->force_threads = force_threads;
+	h->priority = priority;
 
 	if (!thread_ts && since && purple_account_get_bool(sa->account, "thread_history", FALSE)) {
 		/*
@@ -323,9 +487,9 @@ void slack_get_history(SlackAccount *sa, SlackObject *conv, const char *since, u
 	char count_buf[6] = "";
 	snprintf(count_buf, 5, "%u", MIN(count, SLACK_HISTORY_LIMIT_COUNT));
 	if (thread_ts)
-		slack_api_post(sa, get_history_cb, h, "conversations.replies", "channel", id, "oldest", since ?: "0", "limit", count_buf, "ts", thread_ts, NULL);
+		slack_api_post_priority(sa, priority, get_history_cb, h, "conversations.replies", "channel", id, "oldest", since ?: "0", "limit", count_buf, "ts", thread_ts, NULL);
 	else
-		slack_api_post(sa, get_history_cb, h, "conversations.history", "channel", id, "oldest", since ?: "0", "limit", count_buf, NULL);
+		slack_api_post_priority(sa, priority, get_history_cb, h, "conversations.history", "channel", id, "oldest", since ?: "0", "limit", count_buf, NULL);
 }
 
 void slack_get_history_unread(SlackAccount *sa, SlackObject *conv, json_value *json) {
@@ -355,3 +519,18 @@ void slack_get_conversation_unread(SlackAccount *sa, SlackObject *conv) {
 	g_return_if_fail(id);
 	slack_api_post(sa, get_conversation_unread_cb, g_object_ref(conv), "conversations.info", "channel", id, NULL);
 }
+
+static void backfill_history(SlackAccount *sa, SlackObjectTable *table) {
+	SlackObjectTableIter iter;
+	SlackObject *conv;
+	slack_object_table_iter_init(&iter, table);
+	while (slack_object_table_iter_next(&iter, &conv))
+		if (conv->last_mesg)
+			/* in the background, like connect_history, as there may be a lot of them */
+			slack_get_history_priority(sa, SLACK_API_BULK, conv, conv->last_mesg, SLACK_HISTORY_LIMIT_COUNT, NULL, FALSE);
+}
+
+void slack_backfill_history(SlackAccount *sa) {
+	backfill_history(sa, sa->channels);
+	backfill_history(sa, sa->ims);
+}
@@ -18,20 +18,21 @@ static inline const char *slack_conversation_id(SlackObject *chan) {
 	return NULL;
 }
 
-static inline SlackObject *slack_conversation_lookup_id(SlackAccount *sa, const slack_object_id id) {
-	return g_hash_table_lookup(sa->channels, id) ?: g_hash_table_lookup(sa->ims, id);
-}
-
 static inline SlackObject *slack_conversation_lookup_sid(SlackAccount *sa, const char *sid) {
 	if (!sid)
 		return NULL;
-	slack_object_id id;
-	slack_object_id_set(id, sid);
-	return slack_conversation_lookup_id(sa, id);
+	slack_object_key key = slack_object_key_pack(sid);
+	return slack_object_table_lookup_key(sa->channels, key, sid) ?: slack_object_table_lookup_key(sa->ims, key, sid);
+}
+
+static inline SlackObject *slack_conversation_lookup_id(SlackAccount *sa, const slack_object_id id) {
+	return slack_conversation_lookup_sid(sa, id);
 }
 
 /** @name Initialization */
 void slack_conversations_load(SlackAccount *sa);
+/* Apply the conversations.list pages loaded so far, if users and the buddy list are ready for them */
+void slack_conversations_flush(SlackAccount *sa);
 void slack_conversation_counts(SlackAccount *sa);
 
 /** @name API */
@@ -47,6 +48,9 @@ typedef void SlackConversationCallback(SlackAccount *sa, gpointer data, SlackObj
 void slack_conversation_retrieve(SlackAccount *sa, const char *sid, SlackConversationCallback *cb, gpointer data);
 
 void slack_mark_conversation(SlackAccount *sa, PurpleConversation *conv);
+/* Save any marks not yet sent to the account (on disconnect), and send them again after reconnecting */
+void slack_marks_save(SlackAccount *sa);
+void slack_marks_load(SlackAccount *sa);
 
 /**
  * Retrieve and display history for a conversation
@@ -58,6 +62,11 @@ void slack_mark_conversation(SlackAccount *sa, PurpleConversation *conv);
  */
 void slack_get_history(SlackAccount *sa, SlackObject *conv, const char *since, unsigned count, const char *thread_ts, gboolean force_threads);
 
+/**
+ * slack_get_history in the given API lane (rather than interactively once connected)
+ */
+void slack_get_history_priority(SlackAccount *sa, SlackAPIPriority priority, SlackObject *conv, const char *since, unsigned count, const char *thread_ts, gboolean force_threads);
+
 /**
  * Retrieve and display unread history for a conversation
  *
@@ -70,6 +79,12 @@ void slack_get_history_unread(SlackAccount *sa, SlackObject *conv, json_value *j
  */
 void slack_get_conversation_unread(SlackAccount *sa, SlackObject *conv);
 
+/**
+ * Retrieve and display anything newer than the last message seen in each conversation that's had any,
+ * to fill in what was missed while the RTM connection was down
+ */
+void slack_backfill_history(SlackAccount *sa);
+
 /**
  * An opaque element of get_history_queue
  */
@@ -0,0 +1,594 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+
+#include <debug.h>
+#include <proxy.h>
+#include <sslconn.h>
+#include <zlib.h>
+
+#include "slack-http.h"
+
+/* how long to keep an idle connection open (slack seems to close them itself after a minute or two) */
+#define HTTP_IDLE_TIMEOUT 50
+#define HTTP_READ_SIZE 16384
+#define HTTP_MAX_HEADERS 65536
+
+struct _SlackHTTPPool {
+	PurpleAccount *account;
+	GList *conns; /* struct http_conn */
+};
+
+enum http_state {
+	HTTP_HEADERS = 0,
+	HTTP_BODY, /* Content-Length */
+	HTTP_EOF, /* body until close */
+	HTTP_CHUNK_SIZE,
+	HTTP_CHUNK_DATA,
+	HTTP_CHUNK_END,
+	HTTP_TRAILER,
+	HTTP_DONE
+};
+
+struct http_conn {
+	SlackHTTPPool *pool;
+	char *host;
+	int port;
+	gboolean ssl;
+
+	PurpleProxyConnectData *connection;
+	PurpleSslConnection *ssl_connection;
+	int fd;
+	guint inpa;
+	guint timer; /* idle timeout (or deferred connect error) */
+	gboolean connected;
+
+	GQueue requests; /* SlackHTTPRequest, in the order sent; the head is being answered */
+	unsigned responses; /* number of responses completed on this connection */
+
+	GString *output;
+	gsize output_off;
+	GString *input;
+	gsize input_off;
+
+	/* the response currently being read */
+	enum http_state state;
+	gsize remaining;
+	gboolean close; /* server will close after this response */
+	z_stream *inflate; /* Content-Encoding: gzip/deflate, decoded as it arrives */
+	GString *response;
+};
+
+struct _SlackHTTPRequest {
+	char *host;
+	int port;
+	gboolean ssl;
+	char *request;
+	gboolean idempotent;
+	unsigned max_connections;
+	gsize max_len;
+
+	/* sent on a connection that had already been used, so if it closes without any response,
+	 * it was probably a stale keep-alive and we can try again (if idempotent) */
+	gboolean reused;
+	gboolean retried;
+	/* pipelined behind a response that closed the connection, so the server never saw it */
+	gboolean unseen;
+
+	SlackHTTPCallback *callback; /* NULL if cancelled */
+	gpointer user_data;
+};
+
+static void http_request_free(SlackHTTPRequest *req) {
+	g_free(req->host);
+	g_free(req->request);
+	g_free(req);
+}
+
+const char *slack_http_header(const gchar *headers, gsize len, const char *name) {
+	size_t nlen = strlen(name);
+	const gchar *end = headers + len;
+	const gchar *p = headers;
+
+	while ((p = g_strstr_len(p, end - p, "\r\n"))) {
+		p += 2;
+		if ((gsize)(end - p) > nlen && !g_ascii_strncasecmp(p, name, nlen) && p[nlen] == ':') {
+			p += nlen+1;
+			while (p < end && (*p == ' ' || *p == '\t'))
+				p++;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static void conn_inflate_end(struct http_conn *conn) {
+	if (!conn->inflate)
+		return;
+	inflateEnd(conn->inflate);
+	g_free(conn->inflate);
+	conn->inflate = NULL;
+}
+
+static void conn_free(struct http_conn *conn) {
+	conn_inflate_end(conn);
+	conn->pool->conns = g_list_remove(conn->pool->conns, conn);
+
+	if (conn->ssl_connection)
+		purple_ssl_close(conn->ssl_connection);
+	else if (conn->fd >= 0)
+		close(conn->fd);
+	if (conn->connection)
+		purple_proxy_connect_cancel(conn->connection);
+	if (conn->inpa)
+		purple_input_remove(conn->inpa);
+	if (conn->timer)
+		purple_timeout_remove(conn->timer);
+
+	g_queue_foreach(&conn->requests, (GFunc)http_request_free, NULL);
+	g_queue_clear(&conn->requests);
+
+	g_free(conn->host);
+	g_string_free(conn->output, TRUE);
+	g_string_free(conn->input, TRUE);
+	g_string_free(conn->response, TRUE);
+	g_free(conn);
+}
+
+static void http_send(SlackHTTPPool *pool, SlackHTTPRequest *req);
+
+/* Close the connection, and retry or fail all its requests */
+static void conn_fail(struct http_conn *conn, const char *error) {
+	SlackHTTPPool *pool = conn->pool;
+	gboolean partial = conn->state != HTTP_HEADERS || conn->input->len > conn->input_off;
+	GQueue requests = conn->requests;
+	g_queue_init(&conn->requests);
+	purple_debug_misc("slack", "http connection to %s closed (%u responses, %u pending): %s\n", conn->host, conn->responses, requests.length, error);
+	conn_free(conn);
+
+	SlackHTTPRequest *req;
+	gboolean head = TRUE;
+	while ((req = g_queue_pop_head(&requests))) {
+		if (!req->callback)
+			http_request_free(req);
+		else if (req->unseen)
+			http_send(pool, req);
+		else if (req->idempotent && req->reused && !req->retried && !(head && partial)) {
+			req->retried = TRUE;
+			http_send(pool, req);
+		} else {
+			req->callback(req, req->user_data, NULL, 0, error);
+			http_request_free(req);
+		}
+		head = FALSE;
+	}
+}
+
+static gboolean conn_idle_cb(gpointer data) {
+	struct http_conn *conn = data;
+	conn->timer = 0;
+	if (conn->requests.length)
+		conn_fail(conn, "Unable to connect");
+	else
+		conn_free(conn);
+	return FALSE;
+}
+
+static void conn_input_cb(gpointer data, gint source, PurpleInputCondition cond);
+
+static void conn_watch(struct http_conn *conn) {
+	if (conn->inpa) {
+		purple_input_remove(conn->inpa);
+		conn->inpa = 0;
+	}
+
+	PurpleInputCondition cond = (conn->ssl_connection ? 0 : PURPLE_INPUT_READ); /* permanent purple_ssl_input_add for ssl */
+	if (conn->output->len > conn->output_off)
+		cond |= PURPLE_INPUT_WRITE;
+
+	if (cond != 0)
+		conn->inpa = purple_input_add(conn->fd, cond, conn_input_cb, conn);
+}
+
+/* Parse a response header block, returning FALSE if the connection was closed */
+static gboolean conn_headers(struct http_conn *conn, const char *p, gsize len) {
+	if (len < 12 || strncmp(p, "HTTP/1.", 7)) {
+		conn_fail(conn, "Invalid HTTP response");
+		return FALSE;
+	}
+	gboolean http10 = p[7] == '0';
+	int status = atoi(&p[9]);
+	if (status >= 100 && status < 200)
+		/* 100 Continue and such: ignore */
+		return TRUE;
+
+	g_string_append_len(conn->response, p, len);
+
+	const char *connection = slack_http_header(p, len, "Connection");
+	if (http10)
+		conn->close = !(connection && !g_ascii_strncasecmp(connection, "keep-alive", 10));
+	else
+		conn->close = connection && !g_ascii_strncasecmp(connection, "close", 5);
+
+	const char *ce = slack_http_header(p, len, "Content-Encoding");
+	if (ce && (!g_ascii_strncasecmp(ce, "gzip", 4) || !g_ascii_strncasecmp(ce, "deflate", 7))) {
+		conn->inflate = g_new0(z_stream, 1);
+		/* automatic gzip or zlib header detection */
+		if (inflateInit2(conn->inflate, MAX_WBITS+32) != Z_OK) {
+			g_free(conn->inflate);
+			conn->inflate = NULL;
+			conn_fail(conn, "no built-in gzip support in zlib");
+			return FALSE;
+		}
+	}
+
+	const char *te = slack_http_header(p, len, "Transfer-Encoding");
+	const char *cl = slack_http_header(p, len, "Content-Length");
+	if (te && !g_ascii_strncasecmp(te, "chunked", 7))
+		conn->state = HTTP_CHUNK_SIZE;
+	else if (cl) {
+		conn->remaining = g_ascii_strtoull(cl, NULL, 10);
+		conn->state = conn->remaining ? HTTP_BODY : HTTP_DONE;
+	}
+	else if (status == 204 || status == 304)
+		conn->state = HTTP_DONE;
+	else {
+		conn->state = HTTP_EOF;
+		conn->close = TRUE;
+	}
+	return TRUE;
+}
+
+/* Add body data to the current response, decoding directly into it if necessary, returning FALSE if the connection was closed */
+static gboolean conn_body(struct http_conn *conn, const char *p, gsize n) {
+	if (!conn->inflate) {
+		g_string_append_len(conn->response, p, n);
+		return TRUE;
+	}
+
+	z_stream *z = conn->inflate;
+	z->next_in = (Bytef *)p;
+	z->avail_in = n;
+	while (z->avail_in) {
+		gsize len = conn->response->len;
+		/* compressed JSON expands a lot, so leave plenty of room */
+		gsize room = MAX(4*n, HTTP_READ_SIZE);
+		g_string_set_size(conn->response, len + room);
+		z->next_out = (Bytef *)conn->response->str + len;
+		z->avail_out = room;
+		int r = inflate(z, Z_SYNC_FLUSH);
+		g_string_set_size(conn->response, len + room - z->avail_out);
+		if (r == Z_STREAM_END) {
+			/* ignore any trailing garbage */
+			conn_inflate_end(conn);
+			break;
+		}
+		if (r != Z_OK && r != Z_BUF_ERROR) {
+			purple_debug_error("slack", "gzip inflate error: %s\n", z->msg ?: "unknown");
+			conn_fail(conn, "Failed to gunzip response");
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* Deliver the current response, returning FALSE if the connection was closed */
+static gboolean conn_complete(struct http_conn *conn) {
+	if (conn->inflate) {
+		if (conn->inflate->total_in)
+			purple_debug_warning("slack", "truncated gzip response\n");
+		conn_inflate_end(conn);
+	}
+
+	SlackHTTPRequest *req = g_queue_pop_head(&conn->requests);
+	GString *response = conn->response;
+	gboolean closing = conn->close;
+
+	conn->responses++;
+	conn->response = g_string_new(NULL);
+	conn->state = HTTP_HEADERS;
+	conn->close = FALSE;
+
+	if (closing) {
+		/* anything else pipelined was never seen by the server */
+		for (GList *l = conn->requests.head; l; l = l->next)
+			((SlackHTTPRequest *)l->data)->unseen = TRUE;
+		conn_fail(conn, "Connection closed by server");
+	}
+	else if (!conn->requests.length)
+		conn->timer = purple_timeout_add_seconds(HTTP_IDLE_TIMEOUT, conn_idle_cb, conn);
+
+	if (req->callback)
+		req->callback(req, req->user_data, response->str, response->len, NULL);
+	http_request_free(req);
+	g_string_free(response, TRUE);
+	return !closing;
+}
+
+/* Process as much input as we can, returning FALSE if the connection was closed */
+static gboolean conn_parse(struct http_conn *conn) {
+	for (;;) {
+		const char *p = conn->input->str + conn->input_off;
+		gsize avail = conn->input->len - conn->input_off;
+		SlackHTTPRequest *req = g_queue_peek_head(&conn->requests);
+		if (!avail && conn->state != HTTP_DONE)
+			break;
+		if (!req) {
+			conn_fail(conn, "Unexpected HTTP response");
+			return FALSE;
+		}
+
+		switch (conn->state) {
+			case HTTP_HEADERS: {
+				const char *eoh = g_strstr_len(p, avail, "\r\n\r\n");
+				if (!eoh) {
+					if (avail > HTTP_MAX_HEADERS) {
+						conn_fail(conn, "Response headers too long");
+						return FALSE;
+					}
+					goto more;
+				}
+				gsize len = eoh + 4 - p;
+				if (!conn_headers(conn, p, len))
+					return FALSE;
+				conn->input_off += len;
+				break;
+			}
+
+			case HTTP_BODY:
+			case HTTP_EOF:
+			case HTTP_CHUNK_DATA: {
+				gsize n = conn->state == HTTP_EOF ? avail : MIN(avail, conn->remaining);
+				conn->input_off += n;
+				if (!conn_body(conn, p, n))
+					return FALSE;
+				if (conn->response->len > req->max_len) {
+					conn_fail(conn, "Response too large");
+					return FALSE;
+				}
+				if (conn->state != HTTP_EOF && !(conn->remaining -= n))
+					conn->state = conn->state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_END;
+				break;
+			}
+
+			case HTTP_CHUNK_SIZE:
+			case HTTP_CHUNK_END:
+			case HTTP_TRAILER: {
+				const char *eol = g_strstr_len(p, avail, "\r\n");
+				if (!eol) {
+					if (avail > HTTP_MAX_HEADERS) {
+						conn_fail(conn, "Invalid chunked response");
+						return FALSE;
+					}
+					goto more;
+				}
+				conn->input_off += eol + 2 - p;
+				if (conn->state == HTTP_CHUNK_SIZE) {
+					char *e;
+					conn->remaining = strtoul(p, &e, 16);
+					if (e == p) {
+						conn_fail(conn, "Invalid chunked response");
+						return FALSE;
+					}
+					conn->state = conn->remaining ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+				}
+				else if (conn->state == HTTP_CHUNK_END) {
+					if (eol != p) {
+						conn_fail(conn, "Invalid chunked response");
+						return FALSE;
+					}
+					conn->state = HTTP_CHUNK_SIZE;
+				}
+				else if (eol == p)
+					conn->state = HTTP_DONE;
+				break;
+			}
+
+			case HTTP_DONE:
+				if (!conn_complete(conn))
+					return FALSE;
+				break;
+		}
+	}
+
+more:
+	if (conn->input_off) {
+		g_string_erase(conn->input, 0, conn->input_off);
+		conn->input_off = 0;
+	}
+	return TRUE;
+}
+
+static void conn_eof(struct http_conn *conn) {
+	if (conn->state == HTTP_EOF) {
+		conn->state = HTTP_DONE;
+		conn->close = TRUE;
+		conn_parse(conn);
+	}
+	else if (!conn->requests.length)
+		/* idle keep-alive closed by server */
+		conn_free(conn);
+	else
+		conn_fail(conn, "Connection closed");
+}
+
+static void conn_input_cb(gpointer data, G_GNUC_UNUSED gint source, PurpleInputCondition cond) {
+	struct http_conn *conn = data;
+
+	if (cond & PURPLE_INPUT_WRITE) {
+		gssize len = conn->ssl_connection
+			? purple_ssl_write(conn->ssl_connection, conn->output->str + conn->output_off, conn->output->len - conn->output_off)
+			: write(conn->fd, conn->output->str + conn->output_off, conn->output->len - conn->output_off);
+
+		if (len < 0) {
+			if (errno != EAGAIN) {
+				conn_fail(conn, g_strerror(errno));
+				return;
+			}
+		} else if ((conn->output_off += len) >= conn->output->len) {
+			g_string_truncate(conn->output, 0);
+			conn->output_off = 0;
+			conn_watch(conn);
+		}
+	}
+
+	while (cond & PURPLE_INPUT_READ) {
+		gsize off = conn->input->len;
+		g_string_set_size(conn->input, off + HTTP_READ_SIZE);
+		gssize len = conn->ssl_connection
+			? purple_ssl_read(conn->ssl_connection, conn->input->str + off, HTTP_READ_SIZE)
+			: read(conn->fd, conn->input->str + off, HTTP_READ_SIZE);
+		g_string_set_size(conn->input, off + MAX(len, 0));
+
+		if (len < 0) {
+			if (errno != EAGAIN) {
+				conn_fail(conn, g_strerror(errno));
+				return;
+			}
+			cond &= ~PURPLE_INPUT_READ;
+		}
+		else if (len == 0) {
+			conn_eof(conn);
+			return;
+		}
+		else if (!conn_parse(conn))
+			return;
+	}
+}
+
+static void conn_ssl_input_cb(gpointer data, G_GNUC_UNUSED PurpleSslConnection *ssl_connection, PurpleInputCondition cond) {
+	struct http_conn *conn = data;
+	conn_input_cb(data, conn->fd, cond);
+}
+
+static void conn_ssl_connect_cb(gpointer data, PurpleSslConnection *ssl_connection, G_GNUC_UNUSED PurpleInputCondition cond) {
+	struct http_conn *conn = data;
+
+	conn->fd = ssl_connection->fd;
+	conn->connected = TRUE;
+	purple_ssl_input_add(conn->ssl_connection, conn_ssl_input_cb, conn);
+	conn_watch(conn);
+}
+
+static void conn_ssl_error_cb(G_GNUC_UNUSED PurpleSslConnection *ssl_connection, PurpleSslErrorType error, gpointer data) {
+	struct http_conn *conn = data;
+	conn->ssl_connection = NULL;
+	conn_fail(conn, purple_ssl_strerror(error));
+}
+
+static void conn_connect_cb(gpointer data, gint source, const gchar *error_message) {
+	struct http_conn *conn = data;
+	conn->connection = NULL;
+
+	if (source == -1) {
+		conn_fail(conn, error_message ?: "Unable to connect");
+		return;
+	}
+
+	conn->fd = source;
+	conn->connected = TRUE;
+	conn_watch(conn);
+}
+
+static struct http_conn *conn_new(SlackHTTPPool *pool, SlackHTTPRequest *req) {
+	struct http_conn *conn = g_new0(struct http_conn, 1);
+	conn->pool = pool;
+	conn->host = g_strdup(req->host);
+	conn->port = req->port;
+	conn->ssl = req->ssl;
+	conn->fd = -1;
+	g_queue_init(&conn->requests);
+	conn->output = g_string_new(NULL);
+	conn->input = g_string_sized_new(HTTP_READ_SIZE);
+	conn->response = g_string_new(NULL);
+	pool->conns = g_list_prepend(pool->conns, conn);
+
+	purple_debug_misc("slack", "http connecting to %s:%d (%u open)\n", conn->host, conn->port, g_list_length(pool->conns));
+	if (conn->ssl)
+		conn->ssl_connection = purple_ssl_connect(pool->account, conn->host, conn->port,
+				conn_ssl_connect_cb, conn_ssl_error_cb, conn);
+	else
+		conn->connection = purple_proxy_connect(NULL, pool->account, conn->host, conn->port,
+				conn_connect_cb, conn);
+
+	if (!(conn->ssl_connection || conn->connection))
+		/* report the error later, once requests are queued */
+		conn->timer = purple_timeout_add(0, conn_idle_cb, conn);
+
+	return conn;
+}
+
+static void http_send(SlackHTTPPool *pool, SlackHTTPRequest *req) {
+	struct http_conn *conn = NULL;
+	unsigned count = 0;
+
+	/* find the least busy connection to this host */
+	for (GList *l = pool->conns; l; l = l->next) {
+		struct http_conn *c = l->data;
+		if (c->port != req->port || c->ssl != req->ssl || g_ascii_strcasecmp(c->host, req->host))
+			continue;
+		count++;
+		if (!conn || c->requests.length < conn->requests.length)
+			conn = c;
+	}
+
+	/* anything that mustn't be repeated waits for nothing else, so that it can't be lost behind another response */
+	if (!conn || (conn->requests.length && (count < req->max_connections || !req->idempotent)))
+		conn = conn_new(pool, req);
+	else if (conn->timer) {
+		purple_timeout_remove(conn->timer);
+		conn->timer = 0;
+	}
+
+	req->reused = conn->responses > 0;
+	req->unseen = FALSE;
+	g_queue_push_tail(&conn->requests, req);
+	g_string_append(conn->output, req->request);
+	if (conn->connected)
+		conn_watch(conn);
+}
+
+SlackHTTPRequest *slack_http_request(SlackHTTPPool *pool, const char *url, const char *request, gboolean idempotent, unsigned max_connections, gsize max_len, SlackHTTPCallback *callback, gpointer user_data) {
+	char *host = NULL;
+	int port = 0;
+	if (!purple_url_parse(url, &host, &port, NULL, NULL, NULL))
+		return NULL;
+
+	SlackHTTPRequest *req = g_new0(SlackHTTPRequest, 1);
+	req->host = host;
+	req->ssl = !g_ascii_strncasecmp(url, "https://", 8);
+	/* as in purple_websocket_connect, in case of the wrong default port */
+	req->port = req->ssl && port == 80 ? 443 : port;
+	req->request = g_strdup(request);
+	req->idempotent = idempotent;
+	req->max_connections = MAX(max_connections, 1);
+	req->max_len = max_len;
+	req->callback = callback;
+	req->user_data = user_data;
+
+	http_send(pool, req);
+	return req;
+}
+
+void slack_http_request_cancel(SlackHTTPRequest *req) {
+	/* it's already been sent (or queued) on a connection, so we just ignore the response */
+	req->callback = NULL;
+	req->user_data = NULL;
+}
+
+SlackHTTPPool *slack_http_pool_new(PurpleAccount *account) {
+	SlackHTTPPool *pool = g_new0(SlackHTTPPool, 1);
+	pool->account = account;
+	return pool;
+}
+
+void slack_http_pool_free(SlackHTTPPool *pool) {
+	while (pool->conns)
+		conn_free(pool->conns->data);
+	g_free(pool);
+}
@@ -0,0 +1,35 @@
+#ifndef _PURPLE_SLACK_HTTP_H
+#define _PURPLE_SLACK_HTTP_H
+
+#include <glib.h>
+#include <account.h>
+
+/* A small pool of persistent (keep-alive) HTTP/1.1 connections, used for API calls */
+typedef struct _SlackHTTPPool SlackHTTPPool;
+typedef struct _SlackHTTPRequest SlackHTTPRequest;
+
+/* Called with the full response (headers, blank line, and de-chunked and decompressed body), or an error.
+ * Never called inline from slack_http_request. */
+typedef void SlackHTTPCallback(SlackHTTPRequest *req, gpointer user_data, const gchar *response, gsize len, const gchar *error);
+
+SlackHTTPPool *slack_http_pool_new(PurpleAccount *account);
+/* Close all connections and cancel (without callback) any outstanding requests */
+void slack_http_pool_free(SlackHTTPPool *pool);
+
+/**
+ * Send a request to url (only the scheme, host, and port are used), which must be a complete HTTP/1.1 request (including Host header).
+ * Requests are sent on an idle connection to the same host if there is one, or a new connection if fewer than max_connections are open, or else pipelined behind others.
+ * Only idempotent requests are pipelined, or sent again if a connection fails after they may have reached the server;
+ * others always get a connection to themselves (even if that means opening more than max_connections), and fail instead.
+ *
+ * @param idempotent whether the request can safely be repeated
+ * @param max_len maximum (decoded) response size
+ */
+SlackHTTPRequest *slack_http_request(SlackHTTPPool *pool, const char *url, const char *request, gboolean idempotent, unsigned max_connections, gsize max_len, SlackHTTPCallback *callback, gpointer user_data);
+/* Cancel a request, without callback */
+void slack_http_request_cancel(SlackHTTPRequest *req);
+
+/* Find the value of a header (case insensitive) in a response header block of len bytes */
+const char *slack_http_header(const gchar *headers, gsize len, const char *name);
+
+#endif // _PURPLE_SLACK_HTTP_H
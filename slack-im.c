@@ -13,12 +13,11 @@
 
 void slack_presence_sub(SlackAccount *sa) {
 	GString *ids = g_string_new("[");
-	GHashTableIter iter;
-	gpointer id;
+	SlackObjectTableIter iter;
 	SlackUser *user;
-	g_hash_table_iter_init(&iter, sa->ims);
+	slack_object_table_iter_init(&iter, sa->ims);
 	gboolean first = TRUE;
-	while (g_hash_table_iter_next(&iter, &id, (gpointer*)&user)) {
+	while (slack_object_table_iter_next(&iter, (SlackObject**)&user)) {
 		if (!user->object.buddy)
 			continue;
 		if (first)
@@ -45,7 +44,7 @@ SlackUser *slack_im_set(SlackAccount *sa, json_value *json, SlackUser *user, gbo
 	slack_object_id_set(id, sid);
 
 	if (!user)
-		user = g_hash_table_lookup(sa->ims, id);
+		user = (SlackUser*)slack_object_table_lookup(sa->ims, id);
 
 	is_open = json_get_prop_boolean(json, "is_open", is_open);
 	gboolean changed = FALSE;
@@ -54,7 +53,7 @@ SlackUser *slack_im_set(SlackAccount *sa, json_value *json, SlackUser *user, gbo
 	g_return_val_if_fail(user_id, user);
 
 	if (!user) {
-		user = (SlackUser *)slack_object_hash_table_lookup(sa->users, user_id);
+		user = (SlackUser *)slack_object_table_lookup(sa->users, user_id);
 		if (!user) {
 			purple_debug_warning("slack", "IM %s for unknown user: %s\n", sid, user_id);
 			return user;
@@ -63,9 +62,9 @@ SlackUser *slack_im_set(SlackAccount *sa, json_value *json, SlackUser *user, gbo
 		g_warn_if_fail(slack_object_id_is(user->object.id, user_id));
 	if (slack_object_id_cmp(user->im, id)) {
 		if (*user->im)
-			g_hash_table_remove(sa->ims, user->im);
+			slack_object_table_remove(sa->ims, user->im);
 		slack_object_id_copy(user->im, id);
-		g_hash_table_insert(sa->ims, user->im, user);
+		slack_object_table_replace(sa->ims, &user->object);
 		changed = TRUE;
 	}
 
@@ -106,7 +105,7 @@ void slack_im_close(SlackAccount *sa, json_value *json) {
 static void slack_im_open_user(SlackAccount *sa, void *data, SlackUser *user) {
 	json_value *json = data;
 	slack_im_set(sa, json_get_prop(json, "channel"), user, TRUE, TRUE);
-	json_value_free(json);
+	slack_json_free(json);
 }
 
 void slack_im_open(SlackAccount *sa, json_value *json) {
@@ -161,6 +160,9 @@ static gboolean send_im_open_cb(SlackAccount *sa, gpointer data, json_value *jso
 	if (send->thread)
 		slack_api_post(sa, send_im_api_cb, send, "chat.postMessage", "channel", send->user->im, "text", send->msg,
 				"thread_ts", send->thread, "as_user", "true", NULL);
+	else if (!sa->rtm) /* reconnecting */
+		slack_api_post(sa, send_im_api_cb, send, "chat.postMessage", "channel", send->user->im, "text", send->msg,
+				"as_user", "true", NULL);
 	else {
 		GString *channel = append_json_string(g_string_new(NULL), send->user->im);
 		GString *text = append_json_string(g_string_new(NULL), send->msg);
@@ -2,11 +2,132 @@
 
 #include "slack-json.h"
 
+/* Parsed json is bump-allocated from an arena of slabs, and freed all at once.
+ * Standard size slabs are kept around for reuse. */
+#define JSON_SLAB_SIZE	(64*1024)
+#define JSON_SLAB_POOL	16
+#define JSON_ALIGN	8
+
+struct json_slab {
+	struct json_slab *next;
+	size_t size, used;
+	gint64 data[]; /* aligned */
+};
+
+struct json_arena {
+	struct json_slab *slabs; /* current first */
+};
+
+/* value_extra: the index pointer (json.c) then, on the root only, the arena */
+#define json_value_arena(value) \
+	(((struct json_arena **)((json_value *)(value) + 1))[1])
+
+static struct json_slab *json_slab_pool;
+static unsigned json_slab_pool_len;
+
+static struct json_slab *json_slab_new(size_t size) {
+	struct json_slab *slab;
+	if (size == JSON_SLAB_SIZE && json_slab_pool) {
+		slab = json_slab_pool;
+		json_slab_pool = slab->next;
+		json_slab_pool_len--;
+	} else
+		slab = g_malloc(sizeof(*slab) + size);
+	slab->size = size;
+	slab->used = 0;
+	return slab;
+}
+
+static void json_arena_free(struct json_arena *arena) {
+	struct json_slab *slab;
+	while ((slab = arena->slabs)) {
+		arena->slabs = slab->next;
+		if (slab->size == JSON_SLAB_SIZE && json_slab_pool_len < JSON_SLAB_POOL) {
+			slab->next = json_slab_pool;
+			json_slab_pool = slab;
+			json_slab_pool_len++;
+		} else
+			g_free(slab);
+	}
+	g_free(arena);
+}
+
+static void *json_arena_alloc(size_t size, int zero, void *user_data) {
+	struct json_arena *arena = user_data;
+	struct json_slab *slab = arena->slabs;
+	size = (size + JSON_ALIGN-1) & ~(size_t)(JSON_ALIGN-1);
+	if (!slab || slab->size - slab->used < size) {
+		if (size > JSON_SLAB_SIZE/4) {
+			/* big things (long strings and arrays) get their own slab, behind the current one */
+			slab = json_slab_new(size);
+			if (arena->slabs) {
+				slab->next = arena->slabs->next;
+				arena->slabs->next = slab;
+			} else {
+				slab->next = NULL;
+				arena->slabs = slab;
+			}
+		} else {
+			slab = json_slab_new(JSON_SLAB_SIZE);
+			slab->next = arena->slabs;
+			arena->slabs = slab;
+		}
+	}
+	void *p = (char *)slab->data + slab->used;
+	slab->used += size;
+	if (zero)
+		memset(p, 0, size);
+	return p;
+}
+
+static void json_arena_nofree(void *p, void *user_data) {
+	/* everything goes at once in slack_json_free */
+}
+
+json_value *slack_json_parse(const char *buf, size_t len) {
+	struct json_arena *arena = g_new0(struct json_arena, 1);
+	json_settings settings = {
+		.settings = json_enable_index,
+		.mem_alloc = json_arena_alloc,
+		.mem_free = json_arena_nofree,
+		.user_data = arena,
+		.value_extra = 2*sizeof(void *),
+	};
+	json_value *json = json_parse_ex(&settings, buf, len, NULL);
+	if (!json) {
+		json_arena_free(arena);
+		return NULL;
+	}
+	json_value_arena(json) = arena;
+	return json;
+}
+
+void slack_json_free(json_value *json) {
+	if (!json)
+		return;
+	g_return_if_fail(!json->parent);
+	json_arena_free(json_value_arena(json));
+}
+
 json_value *json_get_prop(json_value *val, const char *index) {
 	if (!val || val->type != json_object) {
 		return NULL;
 	}
 
+	json_object_index *idx = json_value_index(val);
+	if (idx) {
+		unsigned int len = strlen(index);
+		unsigned int slot = json_key_hash(index, len) & idx->mask;
+		unsigned int e;
+		while ((e = idx->slots[slot])) {
+			json_object_entry *entry = &val->u.object.values[e-1];
+			if (entry->name_length == len && !memcmp(entry->name, index, len))
+				return entry->value;
+			slot = (slot + 1) & idx->mask;
+		}
+		return NULL;
+	}
+
 	for (unsigned int i = 0; i < val->u.object.length; ++ i) {
 		if (!strcmp (val->u.object.values[i].name, index)) {
 			return val->u.object.values[i].value;
@@ -16,6 +137,218 @@ json_value *json_get_prop(json_value *val, const char *index) {
 	return NULL;
 }
 
+/* Selective parsing: copy only the wanted members into a compact buffer, just scanning past the rest */
+
+static const char *json_skip_ws(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+/* p at opening quote; returns just past the closing quote */
+static const char *json_skip_string(const char *p, const char *end) {
+	for (p++; p < end; p++) {
+		if (*p == '\\')
+			p++;
+		else if (*p == '"')
+			return p+1;
+	}
+	return NULL;
+}
+
+static const char *json_skip_value(const char *p, const char *end) {
+	if (p >= end)
+		return NULL;
+	if (*p == '"')
+		return json_skip_string(p, end);
+	if (*p == '{' || *p == '[') {
+		unsigned depth = 0;
+		while (p < end) {
+			switch (*p) {
+				case '"':
+					if (!(p = json_skip_string(p, end)))
+						return NULL;
+					continue;
+				case '{':
+				case '[':
+					depth++;
+					break;
+				case '}':
+				case ']':
+					if (!--depth)
+						return p+1;
+					break;
+			}
+			p++;
+		}
+		return NULL;
+	}
+	/* number, true, false, null */
+	while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+		p++;
+	return p;
+}
+
+/* 0: skip path, 1: keep all of it, 2: keep some of it */
+static int json_field_match(const char *const *fields, const GString *path) {
+	int match = 0;
+	for (; *fields; fields++) {
+		if (strncmp(*fields, path->str, path->len))
+			continue;
+		if (!(*fields)[path->len])
+			return 1;
+		if ((*fields)[path->len] == '.')
+			match = 2;
+	}
+	return match;
+}
+
+static const char *json_filter(const char *p, const char *end, GString *out, GString *path, const char *const *fields) {
+	p = json_skip_ws(p, end);
+	if (p >= end)
+		return NULL;
+
+	if (*p == '[') {
+		/* arrays are transparent: elements have the same path */
+		g_string_append_c(out, '[');
+		p = json_skip_ws(p+1, end);
+		if (p < end && *p == ']') {
+			g_string_append_c(out, ']');
+			return p+1;
+		}
+		for (;;) {
+			if (!(p = json_filter(p, end, out, path, fields)))
+				return NULL;
+			p = json_skip_ws(p, end);
+			if (p >= end)
+				return NULL;
+			g_string_append_c(out, *p);
+			if (*p == ']')
+				return p+1;
+			if (*p != ',')
+				return NULL;
+			p++;
+		}
+	}
+
+	if (*p != '{') {
+		const char *v = json_skip_value(p, end);
+		if (v)
+			g_string_append_len(out, p, v-p);
+		return v;
+	}
+
+	g_string_append_c(out, '{');
+	gboolean first = TRUE;
+	p = json_skip_ws(p+1, end);
+	if (p < end && *p == '}') {
+		g_string_append_c(out, '}');
+		return p+1;
+	}
+	for (;;) {
+		if (p >= end || *p != '"')
+			return NULL;
+		const char *key = p;
+		if (!(p = json_skip_string(p, end)))
+			return NULL;
+		const char *key_end = p;
+		p = json_skip_ws(p, end);
+		if (p >= end || *p != ':')
+			return NULL;
+		p = json_skip_ws(p+1, end);
+
+		gsize path_len = path->len;
+		if (path_len)
+			g_string_append_c(path, '.');
+		g_string_append_len(path, key+1, key_end-key-2);
+		int match = json_field_match(fields, path);
+		if (match) {
+			if (!first)
+				g_string_append_c(out, ',');
+			first = FALSE;
+			g_string_append_len(out, key, key_end-key);
+			g_string_append_c(out, ':');
+		}
+		const char *v = match == 2
+			? json_filter(p, end, out, path, fields)
+			: json_skip_value(p, end);
+		if (v && match == 1)
+			g_string_append_len(out, p, v-p);
+		g_string_truncate(path, path_len);
+		if (!(p = v))
+			return NULL;
+
+		p = json_skip_ws(p, end);
+		if (p >= end)
+			return NULL;
+		if (*p == '}') {
+			g_string_append_c(out, '}');
+			return p+1;
+		}
+		if (*p != ',')
+			return NULL;
+		p = json_skip_ws(p+1, end);
+	}
+}
+
+gboolean slack_json_peek(const char *buf, size_t len, const char *const *keys, const char **values, size_t *lens) {
+	const char *end = buf+len;
+	unsigned n;
+	for (n = 0; keys[n]; n++)
+		values[n] = NULL;
+
+	const char *p = json_skip_ws(buf, end);
+	if (p >= end || *p != '{')
+		return FALSE;
+	p = json_skip_ws(p+1, end);
+	if (p < end && *p == '}')
+		return TRUE;
+	for (;;) {
+		if (p >= end || *p != '"')
+			return FALSE;
+		const char *key = p+1;
+		if (!(p = json_skip_string(p, end)))
+			return FALSE;
+		size_t key_len = p-1-key;
+		p = json_skip_ws(p, end);
+		if (p >= end || *p != ':')
+			return FALSE;
+		p = json_skip_ws(p+1, end);
+		const char *v = json_skip_value(p, end);
+		if (!v)
+			return FALSE;
+		for (unsigned i = 0; i < n; i++)
+			if (!values[i] && !strncmp(keys[i], key, key_len) && !keys[i][key_len]) {
+				values[i] = p;
+				lens[i] = v-p;
+				break;
+			}
+
+		p = json_skip_ws(v, end);
+		if (p >= end)
+			return FALSE;
+		if (*p == '}')
+			return TRUE;
+		if (*p != ',')
+			return FALSE;
+		p = json_skip_ws(p+1, end);
+	}
+}
+
+json_value *slack_json_parse_fields(const char *buf, size_t len, const char *const *fields) {
+	GString *out = g_string_sized_new(MIN(len, 64*1024));
+	GString *path = g_string_new(NULL);
+	json_value *json;
+	if (json_filter(buf, buf+len, out, path, fields))
+		json = slack_json_parse(out->str, out->len);
+	else
+		/* not what we expected, so let the real parser sort it out */
+		json = slack_json_parse(buf, len);
+	g_string_free(path, TRUE);
+	g_string_free(out, TRUE);
+	return json;
+}
+
 GString *append_json_string(GString *str, const char *s) {
 	g_string_append_c(str, '"');
 	const char *p = s;
@@ -21,6 +21,19 @@
 #define json_get_boolean(JSON, DEF) \
 	json_get_val(JSON, boolean, DEF)
 
+/* Parse json (indexing the keys of larger objects); all json given to json_get_prop must come from here.
+ * The whole tree belongs to whoever holds the root, and is freed at once with slack_json_free (not json_value_free). */
+json_value *slack_json_parse(const char *buf, size_t len);
+void slack_json_free(json_value *json);
+/* Parse only the object members named by fields (NULL terminated, like "members.profile.display_name"), skipping all others.
+ * Arrays don't appear in paths: their elements share the array's path. */
+json_value *slack_json_parse_fields(const char *buf, size_t len, const char *const *fields);
+
+/* Find the named top-level members of an object (keys NULL terminated) without parsing it.
+ * values[i] is set to the raw text of each (strings still quoted and escaped) within buf, or NULL if missing.
+ * Returns FALSE if buf isn't a (complete) object, though any members found before the problem are still set. */
+gboolean slack_json_peek(const char *buf, size_t len, const char *const *keys, const char **values, size_t *lens);
+
 json_value *json_get_prop(json_value *val, const char *prop) __attribute__((pure));
 
 #define json_get_prop_type(JSON, PROP, TYPE) \
@@ -118,7 +118,7 @@ void slack_message_to_html(GString *html, SlackAccount *sa, gchar *s, PurpleMess
 				s++;
 				g_string_append_c(html, '#');
 				if (!b) {
-					SlackChannel *chan = (SlackChannel*)slack_object_hash_table_lookup(sa->channels, s);
+					SlackChannel *chan = (SlackChannel*)slack_object_table_lookup(sa->channels, s);
 					if (chan)
 						b = chan->object.name;
 				}
@@ -135,7 +135,7 @@ void slack_message_to_html(GString *html, SlackAccount *sa, gchar *s, PurpleMess
 				}
 				if (!b) {
 					if (!user)
-						user = (SlackUser*)slack_object_hash_table_lookup(sa->users, s);
+						user = (SlackUser*)slack_object_table_lookup(sa->users, s);
 					if (user)
 						b = user->object.name;
 				}
@@ -539,7 +539,7 @@ void slack_handle_message(SlackAccount *sa, SlackObject *obj, json_value *json,
 		}
 
 		if (!user)
-			user = (SlackUser*)slack_object_hash_table_lookup(sa->users, user_id);
+			user = (SlackUser*)slack_object_table_lookup(sa->users, user_id);
 
 		PurpleConvChat *chat = slack_channel_get_conversation(sa, chan);
 		if (chat) {
@@ -562,7 +562,7 @@ void slack_handle_message(SlackAccount *sa, SlackObject *obj, json_value *json,
 				conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, sa->account, im->object.name);
 			if (!user)
 				/* is this necessary? shouldn't be anyone else in here */
-				user = (SlackUser*)slack_object_hash_table_lookup(sa->users, user_id);
+				user = (SlackUser*)slack_object_table_lookup(sa->users, user_id);
 			purple_conversation_write(conv, user ? user->object.name : user_id ?: username, html->str, flags, mt);
 		}
 	}
@@ -579,7 +579,7 @@ void slack_handle_message(SlackAccount *sa, SlackObject *obj, json_value *json,
 static void handle_message(SlackAccount *sa, gpointer data, SlackObject *obj) {
 	json_value *json = data;
 	slack_handle_message(sa, obj, json, PURPLE_MESSAGE_RECV, FALSE);
-	json_value_free(json);
+	slack_json_free(json);
 }
 
 gboolean slack_message(SlackAccount *sa, json_value *json) {
@@ -607,12 +607,12 @@ void slack_user_typing(SlackAccount *sa, json_value *json) {
 	const char *user_id    = json_get_prop_strptr(json, "user");
 	const char *channel_id = json_get_prop_strptr(json, "channel");
 
-	SlackUser *user = (SlackUser*)slack_object_hash_table_lookup(sa->users, user_id);
+	SlackUser *user = (SlackUser*)slack_object_table_lookup(sa->users, user_id);
 	SlackChannel *chan;
 	if (user && slack_object_id_is(user->im, channel_id)) {
 		/* IM */
 		serv_got_typing(sa->gc, user->object.name, 4, PURPLE_TYPING);
-	} else if (user && (chan = (SlackChannel*)slack_object_hash_table_lookup(sa->channels, channel_id))) {
+	} else if (user && (chan = (SlackChannel*)slack_object_table_lookup(sa->channels, channel_id))) {
 		/* Channel */
 		PurpleConvChat *chat = slack_channel_get_conversation(sa, chan);
 		PurpleConvChatBuddy *cb = chat ? purple_conv_chat_cb_find(chat, user->object.name) : NULL;
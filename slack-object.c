@@ -1,14 +1,120 @@
 #include "slack-object.h"
 
 guint slack_object_id_hash(gconstpointer p) {
-	const guint *x = p+1;
-	return x[0] ^ (x[1] << 1);
+	return slack_object_key_hash(slack_object_key_pack(p));
+}
+
+const guchar slack_object_key_digits[256] = {
+	[1 ... 255] = 37,
+	['0'] = 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+	['A'] = 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36,
+};
+
+slack_object_key slack_object_key_string(const char *s) {
+	/* FNV-1a, as far as an id would go */
+	guint64 h = G_GUINT64_CONSTANT(0xCBF29CE484222325);
+	for (unsigned i = 0; i < SLACK_OBJECT_ID_SIZ-1 && s[i]; i++)
+		h = (h ^ (guchar)s[i]) * G_GUINT64_CONSTANT(0x100000001B3);
+	return h | SLACK_OBJECT_KEY_STRING;
 }
 
 gboolean slack_object_id_equal(gconstpointer a, gconstpointer b) {
 	return !slack_object_id_cmp(a, b);
 }
 
+#define TABLE_MIN 16 /* initial size */
+
+SlackObjectTable *slack_object_table_new(gsize id_offset, gboolean owned) {
+	SlackObjectTable *table = g_new0(SlackObjectTable, 1);
+	table->entries = g_new0(struct _SlackObjectTableEntry, TABLE_MIN);
+	table->mask = TABLE_MIN-1;
+	table->owned = owned;
+	table->id_offset = id_offset;
+	return table;
+}
+
+void slack_object_table_free(SlackObjectTable *table) {
+	if (table->owned)
+		for (guint i = 0; i <= table->mask; i++)
+			if (table->entries[i].obj)
+				g_object_unref(table->entries[i].obj);
+	g_free(table->entries);
+	g_free(table);
+}
+
+/* The slot with id (packed into key), or the empty one where it would go */
+static struct _SlackObjectTableEntry *table_slot(SlackObjectTable *table, slack_object_key key, const char *id) {
+	for (guint i = slack_object_key_hash(key) & table->mask;; i = (i+1) & table->mask) {
+		struct _SlackObjectTableEntry *e = &table->entries[i];
+		if (!e->obj || (e->key == key && (!(key & SLACK_OBJECT_KEY_STRING) || slack_object_id_is(slack_object_table_id(table, e->obj), id))))
+			return e;
+	}
+}
+
+/* The empty slot where key goes, when it's known not to be there already */
+static struct _SlackObjectTableEntry *table_free_slot(SlackObjectTable *table, slack_object_key key) {
+	guint i = slack_object_key_hash(key) & table->mask;
+	while (table->entries[i].obj)
+		i = (i+1) & table->mask;
+	return &table->entries[i];
+}
+
+static void table_resize(SlackObjectTable *table, guint size) {
+	struct _SlackObjectTableEntry *old = table->entries;
+	guint old_size = table->mask+1;
+	table->entries = g_new0(struct _SlackObjectTableEntry, size);
+	table->mask = size-1;
+	for (guint i = 0; i < old_size; i++)
+		if (old[i].obj)
+			*table_free_slot(table, old[i].key) = old[i];
+	g_free(old);
+}
+
+void slack_object_table_replace(SlackObjectTable *table, SlackObject *obj) {
+	g_return_if_fail(obj);
+	const char *id = slack_object_table_id(table, obj);
+	slack_object_key key = slack_object_key_pack(id);
+	struct _SlackObjectTableEntry *e = table_slot(table, key, id);
+	if (e->obj) {
+		if (table->owned && e->obj != obj)
+			g_object_unref(e->obj);
+		e->obj = obj;
+		return;
+	}
+
+	/* keep it at most 3/4 full */
+	if (4*(table->count+1) > 3*(table->mask+1)) {
+		table_resize(table, 2*(table->mask+1));
+		e = table_free_slot(table, key);
+	}
+	e->key = key;
+	e->obj = obj;
+	table->count++;
+}
+
+gboolean slack_object_table_remove(SlackObjectTable *table, const char *id) {
+	struct _SlackObjectTableEntry *e = table_slot(table, slack_object_key_pack(id), id);
+	SlackObject *obj = e->obj;
+	if (!obj)
+		return FALSE;
+
+	/* close the gap by moving back any later entries in the run that belong at or before it */
+	guint i = e - table->entries;
+	for (guint j = (i+1) & table->mask; table->entries[j].obj; j = (j+1) & table->mask) {
+		guint home = slack_object_key_hash(table->entries[j].key) & table->mask;
+		if (((j - home) & table->mask) >= ((j - i) & table->mask)) {
+			table->entries[i] = table->entries[j];
+			i = j;
+		}
+	}
+	memset(&table->entries[i], 0, sizeof(table->entries[i]));
+	table->count--;
+
+	if (table->owned)
+		g_object_unref(obj);
+	return TRUE;
+}
+
 G_DEFINE_ABSTRACT_TYPE(SlackObject, slack_object, G_TYPE_OBJECT);
 
 static void slack_object_finalize(GObject *gobj) {
@@ -33,6 +33,38 @@ static inline gboolean slack_object_id_is(const slack_object_id id, const char *
 	return s ? !strncmp(id, s, SLACK_OBJECT_ID_SIZ-1) : !*id;
 }
 
+/* An id packed into an integer: the (at most SLACK_OBJECT_ID_SIZ-1) characters of an id made of [0-9A-Z] (as they all seem to be)
+ * as base 37 digits 1-36, which is lossless and always fits in 63 bits.
+ * Anything else gets SLACK_OBJECT_KEY_STRING and a hash of the string, so it also has to be compared as a string. */
+typedef guint64 slack_object_key;
+#define SLACK_OBJECT_KEY_STRING (G_GUINT64_CONSTANT(1) << 63)
+
+slack_object_key slack_object_key_string(const char *s);
+/* the digit for each character: 0 for the end, 1-36 for [0-9A-Z], more for anything else */
+extern const guchar slack_object_key_digits[256];
+
+static inline slack_object_key slack_object_key_pack(const char *s) {
+	slack_object_key k = 0;
+	for (unsigned i = 0; i < SLACK_OBJECT_ID_SIZ-1; i++) {
+		guint d = slack_object_key_digits[(guchar)s[i]];
+		if (!d)
+			break;
+		if (d > 36)
+			return slack_object_key_string(s);
+		k = 37*k + d;
+	}
+	return k;
+}
+
+static inline guint64 slack_object_key_hash(slack_object_key k) {
+	k ^= k >> 31;
+	k *= G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+	k ^= k >> 29;
+	k *= G_GUINT64_CONSTANT(0x94D049BB133111EB);
+	return k ^ (k >> 32);
+}
+
+/* For GHashTables keyed by slack_object_id */
 guint slack_object_id_hash(gconstpointer id);
 gboolean slack_object_id_equal(gconstpointer a, gconstpointer b);
 
@@ -54,25 +86,70 @@ struct _SlackObject {
 #define SLACK_TYPE_OBJECT slack_object_get_type()
 G_DECLARE_FINAL_TYPE(SlackObject, slack_object, SLACK, OBJECT, GObject)
 
-#define slack_object_hash_table_new() \
-	g_hash_table_new_full(slack_object_id_hash, slack_object_id_equal, NULL, g_object_unref)
-
-static inline void slack_object_hash_table_replace(GHashTable *hash_table, SlackObject *obj) {
-	g_hash_table_replace(hash_table, obj->id, obj);
+/* A table of SlackObjects by a slack_object_id in each (usually their own id, but for ims SlackUser.im, which mustn't change while it's in the table),
+ * with the packed keys stored inline and linear probing, for sa->users, sa->channels, and sa->ims */
+typedef struct _SlackObjectTable {
+	struct _SlackObjectTableEntry {
+		slack_object_key key;
+		SlackObject *obj; /* NULL if empty */
+	} *entries;
+	guint mask; /* size-1, a power of 2 */
+	guint count;
+	gboolean owned; /* objects are unreffed when removed (but not reffed when added) */
+	gsize id_offset; /* of the slack_object_id in each object that it's keyed by */
+} SlackObjectTable;
+
+typedef struct _SlackObjectTableIter {
+	SlackObjectTable *table;
+	guint i;
+} SlackObjectTableIter;
+
+SlackObjectTable *slack_object_table_new(gsize id_offset, gboolean owned);
+void slack_object_table_free(SlackObjectTable *table);
+/* Add obj, or replace whatever had its id */
+void slack_object_table_replace(SlackObjectTable *table, SlackObject *obj);
+gboolean slack_object_table_remove(SlackObjectTable *table, const char *id);
+
+#define slack_object_table_id(table, obj) \
+	((const char *)(obj) + (table)->id_offset)
+
+/* Look up an id (a slack_object_id or any string) already packed into key */
+static inline SlackObject *slack_object_table_lookup_key(const SlackObjectTable *table, slack_object_key key, const char *id) {
+	/* never full, so there's always an empty slot to stop at */
+	for (guint i = slack_object_key_hash(key) & table->mask;; i = (i+1) & table->mask) {
+		const struct _SlackObjectTableEntry *e = &table->entries[i];
+		if (!e->obj)
+			return NULL;
+		if (e->key == key && (!(key & SLACK_OBJECT_KEY_STRING) || slack_object_id_is(slack_object_table_id(table, e->obj), id)))
+			return e->obj;
+	}
 }
 
-static inline SlackObject *slack_object_hash_table_lookup(GHashTable *hash_table, const char *sid) {
-	if (!sid)
+static inline SlackObject *slack_object_table_lookup(const SlackObjectTable *table, const char *id) {
+	if (!id)
 		return NULL;
-	slack_object_id id;
-	slack_object_id_set(id, sid);
-	return g_hash_table_lookup(hash_table, id);
+	return slack_object_table_lookup_key(table, slack_object_key_pack(id), id);
 }
 
-static inline gboolean slack_object_hash_table_remove(GHashTable *hash_table, const char *sid) {
-	slack_object_id id;
-	slack_object_id_set(id, sid);
-	return g_hash_table_remove(hash_table, id);
+static inline guint slack_object_table_size(const SlackObjectTable *table) {
+	return table->count;
+}
+
+static inline void slack_object_table_iter_init(SlackObjectTableIter *iter, SlackObjectTable *table) {
+	iter->table = table;
+	iter->i = 0;
+}
+
+/* Nothing may be added to or removed from the table while iterating */
+static inline gboolean slack_object_table_iter_next(SlackObjectTableIter *iter, SlackObject **obj) {
+	while (iter->i <= iter->table->mask) {
+		SlackObject *o = iter->table->entries[iter->i++].obj;
+		if (o) {
+			*obj = o;
+			return TRUE;
+		}
+	}
+	return FALSE;
 }
 
 #endif
@@ -9,6 +9,7 @@
 #include "slack-blist.h"
 #include "slack-message.h"
 #include "slack-channel.h"
+#include "slack-conversation.h"
 #include "slack-rtm.h"
 
 struct _SlackRTMCall {
@@ -17,72 +18,368 @@ struct _SlackRTMCall {
 	gpointer data;
 };
 
-static gboolean rtm_msg(SlackAccount *sa, const char *type, json_value *json) {
-	if (!strcmp(type, "message")) {
-		return slack_message(sa, json);
-	}
-	else if (!strcmp(type, "user_typing")) {
-		slack_user_typing(sa, json);
-	}
-	else if (!strcmp(type, "presence_change") ||
-	         !strcmp(type, "presence_change_batch")) {
-		slack_presence_change(sa, json);
+/* RTM event handlers: return TRUE to keep json (which must then be freed with slack_json_free) */
+typedef gboolean rtm_handler(SlackAccount *sa, json_value *json, int arg);
+
+static gboolean rtm_message(SlackAccount *sa, json_value *json, int arg) {
+	return slack_message(sa, json);
+}
+
+static gboolean rtm_user_typing(SlackAccount *sa, json_value *json, int arg) {
+	slack_user_typing(sa, json);
+	return FALSE;
+}
+
+static gboolean rtm_presence_change(SlackAccount *sa, json_value *json, int arg) {
+	slack_presence_change(sa, json);
+	return FALSE;
+}
+
+static gboolean rtm_im_close(SlackAccount *sa, json_value *json, int arg) {
+	slack_im_close(sa, json);
+	return FALSE;
+}
+
+static gboolean rtm_im_open(SlackAccount *sa, json_value *json, int arg) {
+	slack_im_open(sa, json);
+	return TRUE;
+}
+
+static gboolean rtm_member_joined_channel(SlackAccount *sa, json_value *json, int joined) {
+	slack_member_joined_channel(sa, json, joined);
+	return FALSE;
+}
+
+static gboolean rtm_user_changed(SlackAccount *sa, json_value *json, int arg) {
+	slack_user_changed(sa, json);
+	return FALSE;
+}
+
+static gboolean rtm_channel_update(SlackAccount *sa, json_value *json, int type) {
+	slack_channel_update(sa, json, type);
+	return FALSE;
+}
+
+static void rtm_resumed(SlackAccount *sa);
+
+static gboolean rtm_hello(SlackAccount *sa, json_value *json, int arg) {
+	if (sa->rtm_resume)
+		rtm_resumed(sa);
+	else
+		slack_login_done(sa, SLACK_LOGIN_RTM);
+	return FALSE;
+}
+
+/* Known RTM event types.  Add new ones here: the dispatch table is built from this. */
+static const struct rtm_event {
+	const char *type;
+	rtm_handler *handler; /* NULL to ignore (just count) */
+	int arg;
+	gboolean directory; /* changes users or conversations, so must not be overtaken by their lists (see rtm_hold) */
+} rtm_events[] = {
+	{ "message",			rtm_message },
+	{ "user_typing",		rtm_user_typing },
+	{ "presence_change",		rtm_presence_change },
+	{ "presence_change_batch",	rtm_presence_change },
+	{ "im_close",			rtm_im_close, 0, TRUE },
+	{ "im_open",			rtm_im_open, 0, TRUE },
+	/* not necessarily (and probably in reality never) open, but works as no-op in that case */
+	{ "im_created",			rtm_im_open, 0, TRUE },
+	{ "member_joined_channel",	rtm_member_joined_channel, TRUE, TRUE },
+	{ "member_left_channel",	rtm_member_joined_channel, FALSE, TRUE },
+	{ "user_change",		rtm_user_changed, 0, TRUE },
+	{ "team_join",			rtm_user_changed, 0, TRUE },
+	{ "channel_joined",		rtm_channel_update, SLACK_CHANNEL_MEMBER, TRUE },
+	{ "group_joined",		rtm_channel_update, SLACK_CHANNEL_GROUP, TRUE },
+	{ "group_unarchive",		rtm_channel_update, SLACK_CHANNEL_GROUP, TRUE },
+	{ "channel_left",		rtm_channel_update, SLACK_CHANNEL_PUBLIC, TRUE },
+	{ "channel_created",		rtm_channel_update, SLACK_CHANNEL_PUBLIC, TRUE },
+	{ "channel_unarchive",		rtm_channel_update, SLACK_CHANNEL_PUBLIC, TRUE },
+	{ "channel_rename",		rtm_channel_update, SLACK_CHANNEL_UNKNOWN, TRUE },
+	{ "group_rename",		rtm_channel_update, SLACK_CHANNEL_UNKNOWN, TRUE },
+	{ "channel_archive",		rtm_channel_update, SLACK_CHANNEL_DELETED, TRUE },
+	{ "channel_deleted",		rtm_channel_update, SLACK_CHANNEL_DELETED, TRUE },
+	{ "group_archive",		rtm_channel_update, SLACK_CHANNEL_DELETED, TRUE },
+	{ "group_left",			rtm_channel_update, SLACK_CHANNEL_DELETED, TRUE },
+	{ "hello",			rtm_hello },
+
+	{ "reconnect_url" },
+	{ "pref_change" },
+	{ "emoji_changed" },
+	{ "dnd_updated" },
+	{ "dnd_updated_user" },
+	{ "desktop_notification" },
+	{ "channel_marked" },
+	{ "group_marked" },
+	{ "im_marked" },
+	{ "mpim_marked" },
+	{ "thread_marked" },
+	{ "update_thread_state" },
+	{ "reaction_added" },
+	{ "reaction_removed" },
+	{ "star_added" },
+	{ "star_removed" },
+	{ "pin_added" },
+	{ "pin_removed" },
+	{ "file_shared" },
+	{ "file_public" },
+	{ "file_created" },
+	{ "file_change" },
+	{ "file_deleted" },
+	{ "commands_changed" },
+	{ "bot_added" },
+	{ "bot_changed" },
+	{ "subteam_updated" },
+	{ "user_huddle_changed" },
+};
+
+#define RTM_EVENTS		G_N_ELEMENTS(rtm_events)
+#define RTM_EVENT_UNKNOWN	RTM_EVENTS /* index of stats for everything else */
+
+struct rtm_event_stats {
+	guint count;
+	gint64 time; /* usec in handler (with api_stats) */
+};
+
+/* Perfect hash of rtm_events types: a seed is picked so that every type lands in its own slot */
+#define RTM_EVENT_SLOTS 256
+static guint8 rtm_event_slots[RTM_EVENT_SLOTS]; /* rtm_events index + 1, or 0 */
+static guint32 rtm_event_seed;
+
+static inline guint32 rtm_event_hash(guint32 seed, const char *type) {
+	guint32 h = seed;
+	while (*type)
+		h = (h ^ (guchar)*type++) * 16777619u;
+	/* the low bits of FNV only depend on the low bits of the seed */
+	return (h >> 16) & (RTM_EVENT_SLOTS-1);
+}
+
+static void rtm_events_init(void) {
+	G_STATIC_ASSERT(RTM_EVENTS < RTM_EVENT_SLOTS/2);
+	for (guint32 seed = 2166136261u; seed != 2166136261u + (1 << 20); seed++) {
+		memset(rtm_event_slots, 0, sizeof(rtm_event_slots));
+		unsigned i;
+		for (i = 0; i < RTM_EVENTS; i++) {
+			guint8 *slot = &rtm_event_slots[rtm_event_hash(seed, rtm_events[i].type)];
+			if (*slot) {
+				if (!strcmp(rtm_events[*slot-1].type, rtm_events[i].type))
+					g_error("duplicate RTM event %s", rtm_events[i].type);
+				break;
+			}
+			*slot = i+1;
+		}
+		if (i == RTM_EVENTS) {
+			rtm_event_seed = seed;
+			return;
+		}
 	}
-	else if (!strcmp(type, "im_close")) {
-		slack_im_close(sa, json);
+	g_error("no perfect hash for RTM events: make RTM_EVENT_SLOTS bigger");
+}
+
+static const struct rtm_event *rtm_event_lookup(const char *type) {
+	if (!rtm_event_seed)
+		rtm_events_init();
+	guint8 i = rtm_event_slots[rtm_event_hash(rtm_event_seed, type)];
+	if (i && !strcmp(rtm_events[i-1].type, type))
+		return &rtm_events[i-1];
+	return NULL;
+}
+
+static struct rtm_event_stats *rtm_event_count(SlackAccount *sa, const struct rtm_event *event) {
+	if (!sa->rtm_stats)
+		sa->rtm_stats = g_new0(struct rtm_event_stats, RTM_EVENTS+1);
+	struct rtm_event_stats *stats = &sa->rtm_stats[event ? event - rtm_events : RTM_EVENT_UNKNOWN];
+	stats->count++;
+	return stats;
+}
+
+/* Return TRUE to keep json (which must then be freed with slack_json_free) */
+static gboolean rtm_msg(SlackAccount *sa, const char *type, json_value *json) {
+	const struct rtm_event *event = rtm_event_lookup(type);
+	struct rtm_event_stats *stats = rtm_event_count(sa, event);
+
+	if (!event) {
+		purple_debug_info("slack", "Unhandled RTM type %s\n", type);
+		return FALSE;
 	}
-	else if (!strcmp(type, "im_open")) {
-		slack_im_open(sa, json);
+	if (!event->handler)
+		return FALSE;
+
+	if (!sa->api_stats)
+		return event->handler(sa, json, event->arg);
+	gint64 start = g_get_monotonic_time();
+	gboolean keep = event->handler(sa, json, event->arg);
+	stats->time += g_get_monotonic_time() - start;
+	return keep;
+}
+
+/* Should this event wait until users and conversations are loaded?  Everything does until there's at least a snapshot,
+ * and then directory events do until users.list and conversations.list have caught up, lest their older pages undo them */
+static gboolean rtm_hold(SlackAccount *sa, const char *type) {
+	if (!slack_login_directory_ready(sa))
 		return TRUE;
+	if (slack_login_is_done(sa, SLACK_LOGIN_CONVERSATIONS))
+		return FALSE;
+	const struct rtm_event *event = rtm_event_lookup(type);
+	return event && event->directory;
+}
+
+void slack_rtm_stats(SlackAccount *sa, GString *out) {
+	if (sa->rtm) {
+		const PurpleWebsocketStats *ws = purple_websocket_stats(sa->rtm);
+		g_string_append_printf(out, "RTM bytes: %" G_GUINT64_FORMAT " received (%" G_GUINT64_FORMAT " on the wire), %" G_GUINT64_FORMAT " sent (%" G_GUINT64_FORMAT " on the wire)\n",
+				ws->in, ws->in_wire, ws->out, ws->out_wire);
+		g_string_append_printf(out, "RTM pings: %u answered of %u", ws->pongs, ws->pings);
+		if (ws->pongs)
+			g_string_append_printf(out, ", round trip %.1fms (average %.1fms, max %.1fms)",
+					ws->rtt / 1000.0, ws->srtt / 1000.0, ws->rtt_max / 1000.0);
+		g_string_append_c(out, '\n');
 	}
-	else if (!strcmp(type, "member_joined_channel")) {
-		slack_member_joined_channel(sa, json, TRUE);
-	}
-	else if (!strcmp(type, "member_left_channel")) {
-		slack_member_joined_channel(sa, json, FALSE);
+	if (!sa->rtm_stats)
+		return;
+	g_string_append(out, "RTM events:\n");
+	for (unsigned i = 0; i <= RTM_EVENTS; i++) {
+		const struct rtm_event_stats *stats = &sa->rtm_stats[i];
+		if (!stats->count)
+			continue;
+		g_string_append_printf(out, "  %s: %u", i < RTM_EVENTS ? rtm_events[i].type : "(unhandled)", stats->count);
+		if (stats->time)
+			g_string_append_printf(out, ", %.1fms", stats->time / 1000.0);
+		g_string_append_c(out, '\n');
 	}
-	else if (!strcmp(type, "user_change") ||
-		 !strcmp(type, "team_join")) {
-		slack_user_changed(sa, json);
+}
+
+/* Events made irrelevant by account settings, or listed in ignore_rtm_events */
+static void rtm_ignore_init(SlackAccount *sa) {
+	if (sa->rtm_ignore)
+		g_hash_table_remove_all(sa->rtm_ignore);
+	else
+		sa->rtm_ignore = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	if (!purple_account_get_bool(sa->account, "channel_members", TRUE)) {
+		/* we never fetched the member lists, so there's nothing to update */
+		g_hash_table_add(sa->rtm_ignore, g_strdup("member_joined_channel"));
+		g_hash_table_add(sa->rtm_ignore, g_strdup("member_left_channel"));
 	}
-	else if (!strcmp(type, "im_created")) {
-		/* not necessarily (and probably in reality never) open, but works as no-op in that case */
-		slack_im_open(sa, json);
+
+	gchar **types = g_strsplit_set(purple_account_get_string(sa->account, "ignore_rtm_events", ""), " ,", -1);
+	for (gchar **t = types; *t; t++)
+		if (**t)
+			g_hash_table_add(sa->rtm_ignore, g_strdup(*t));
+	g_strfreev(types);
+}
+
+/* Look at just the type of an event without parsing it: if it's one we'd drop anyway, count it and return TRUE.
+ * A partial message can be dropped as soon as we have the type, as events are never replies. */
+static gboolean rtm_drop(SlackAccount *sa, const guchar *msg, size_t len, gboolean partial) {
+	static const char *const keys[] = { "type", "reply_to", NULL };
+	const char *values[2];
+	size_t lens[2];
+	char type[64];
+
+	if (!slack_json_peek((const char *)msg, len, keys, values, lens) && !partial)
+		return FALSE;
+	/* replies are never dropped, and escaped types are left for the parser */
+	if (values[1] || !values[0] || lens[0] < 2 || lens[0] - 2 >= sizeof(type) || *values[0] != '"' || memchr(values[0], '\\', lens[0]))
+		return FALSE;
+	memcpy(type, values[0]+1, lens[0]-2);
+	type[lens[0]-2] = 0;
+
+	const struct rtm_event *event = rtm_event_lookup(type);
+	if ((event && !event->handler) || g_hash_table_contains(sa->rtm_ignore, type)) {
+		rtm_event_count(sa, event);
 		return TRUE;
 	}
-	else if (!strcmp(type, "channel_joined")) {
-		slack_channel_update(sa, json, SLACK_CHANNEL_MEMBER);
-	}
-	else if (!strcmp(type, "group_joined") ||
-		 !strcmp(type, "group_unarchive")) {
-		slack_channel_update(sa, json, SLACK_CHANNEL_GROUP);
-	}
-	else if (!strcmp(type, "channel_left") ||
-	         !strcmp(type, "channel_created") ||
-	         !strcmp(type, "channel_unarchive")) {
-		slack_channel_update(sa, json, SLACK_CHANNEL_PUBLIC);
-	}
-	else if (!strcmp(type, "channel_rename") ||
-		 !strcmp(type, "group_rename")) {
-		slack_channel_update(sa, json, SLACK_CHANNEL_UNKNOWN);
-	}
-	else if (!strcmp(type, "channel_archive") ||
-		 !strcmp(type, "channel_deleted") ||
-		 !strcmp(type, "group_archive") ||
-		 !strcmp(type, "group_left")) {
-		slack_channel_update(sa, json, SLACK_CHANNEL_DELETED);
-	}
-	else if (!strcmp(type, "hello")) {
-		slack_login_step(sa);
-	}
-	else {
-		purple_debug_info("slack", "Unhandled RTM type %s\n", type);
+	return FALSE;
+}
+
+/* Fail any RTM calls still waiting for replies that won't come now */
+static void rtm_calls_fail(SlackAccount *sa, const char *error) {
+	GHashTableIter iter;
+	gpointer call;
+	g_hash_table_iter_init(&iter, sa->rtm_call);
+	while (g_hash_table_iter_next(&iter, NULL, &call)) {
+		g_hash_table_iter_steal(&iter);
+		((SlackRTMCall *)call)->callback(sa, ((SlackRTMCall *)call)->data, NULL, error);
+		g_free(call);
 	}
+}
+
+/* Times to try reconnecting the RTM socket alone, waiting 1, 2, 4, ... seconds first */
+#define RTM_RESUME_TRIES 6
+
+static gboolean rtm_resume_cb(gpointer data) {
+	SlackAccount *sa = data;
+	sa->rtm_resume_timer = 0;
+	slack_rtm_connect(sa);
 	return FALSE;
 }
 
+/* Lost the RTM connection (or couldn't get it back): once logged in, try to reconnect just that, keeping everything else,
+ * a few times with backoff before giving up and having purple log in again from scratch */
+static void rtm_lost(SlackAccount *sa, const char *error) {
+	sa->rtm = NULL;
+	if (sa->gc->wants_to_die || sa->closing)
+		return; /* going away anyway */
+	rtm_calls_fail(sa, "Connection lost: message may not have been sent");
+
+	if (purple_connection_get_state(sa->gc) != PURPLE_CONNECTED || sa->rtm_resume >= RTM_RESUME_TRIES) {
+		purple_connection_error_reason(sa->gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR, error);
+		return;
+	}
+
+	if (!sa->rtm_resume)
+		sa->rtm_lost = g_get_monotonic_time();
+	guint delay = 1 << sa->rtm_resume++;
+	purple_debug_info("slack", "RTM connection lost (%s): reconnecting in %us\n", error, delay);
+	sa->rtm_resume_timer = purple_timeout_add_seconds(delay, rtm_resume_cb, sa);
+}
+
+static void rtm_resumed(SlackAccount *sa) {
+	purple_debug_info("slack", "RTM resumed after %.3fs, %u attempts\n",
+			(g_get_monotonic_time() - sa->rtm_lost) / (double)G_USEC_PER_SEC, sa->rtm_resume);
+	sa->rtm_resume = 0;
+	slack_presence_sub(sa);
+	slack_backfill_history(sa);
+}
+
+/* Long messages come in pieces of this size, so we can drop them early */
+#define RTM_PARTIAL (64*1024)
+
 static void rtm_cb(PurpleWebsocket *ws, gpointer data, PurpleWebsocketOp op, const guchar *msg, size_t len) {
 	SlackAccount *sa = data;
+	GString *partial = NULL;
+
+	if (op == PURPLE_WEBSOCKET_TEXT_PARTIAL) {
+		if (sa->rtm_discard)
+			return;
+		if (!sa->rtm_partial) {
+			if (rtm_drop(sa, msg, len, TRUE)) {
+				sa->rtm_discard = TRUE;
+				return;
+			}
+			sa->rtm_partial = g_string_sized_new(2*len);
+		}
+		g_string_append_len(sa->rtm_partial, (const char *)msg, len);
+		return;
+	}
+	if (op == PURPLE_WEBSOCKET_TEXT) {
+		if (sa->rtm_discard) {
+			/* the end of a dropped message */
+			sa->rtm_discard = FALSE;
+			return;
+		}
+		if (sa->rtm_partial) {
+			/* we'd need an incremental parser to do better than collecting it all */
+			partial = sa->rtm_partial;
+			sa->rtm_partial = NULL;
+			g_string_append_len(partial, (const char *)msg, len);
+			msg = (const guchar *)partial->str;
+			len = partial->len;
+		}
+		else if (rtm_drop(sa, msg, len, FALSE))
+			return;
+	}
 
 	purple_debug_misc("slack", "RTM %x: %.*s\n", op, (int)len, msg);
 	switch (op) {
@@ -90,18 +387,15 @@ static void rtm_cb(PurpleWebsocket *ws, gpointer data, PurpleWebsocketOp op, con
 			break;
 		case PURPLE_WEBSOCKET_ERROR:
 		case PURPLE_WEBSOCKET_CLOSE:
-			purple_connection_error_reason(sa->gc,
-					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					(const char *)msg ?: "RTM connection closed");
-			sa->rtm = NULL;
-			break;
+			rtm_lost(sa, (const char *)msg ?: "RTM connection closed");
+			return;
 		case PURPLE_WEBSOCKET_OPEN:
-			slack_login_step(sa);
+			purple_debug_info("slack", "RTM connected\n");
 		default:
 			return;
 	}
 
-	json_value *json = json_parse((const char *)msg, len);
+	json_value *json = slack_json_parse((const char *)msg, len);
 	json_value *reply_to = json_get_prop_type(json, "reply_to", integer);
 	const char *type = json_get_prop_strptr(json, "type");
 
@@ -121,7 +415,11 @@ static void rtm_cb(PurpleWebsocket *ws, gpointer data, PurpleWebsocketOp op, con
 		}
 	}
 	else if (type) {
-		if (rtm_msg(sa, type, json))
+		if (strcmp(type, "hello") && rtm_hold(sa, type)) {
+			/* wait for slack_rtm_release */
+			g_queue_push_tail(&sa->rtm_held, json);
+			json = NULL;
+		} else if (rtm_msg(sa, type, json))
 			json = NULL;
 	}
 	else {
@@ -132,24 +430,85 @@ static void rtm_cb(PurpleWebsocket *ws, gpointer data, PurpleWebsocketOp op, con
 	}
 
 	if (json)
-		json_value_free(json);
+		slack_json_free(json);
+	if (partial)
+		g_string_free(partial, TRUE);
 }
 
+void slack_rtm_release(SlackAccount *sa) {
+	if (!g_queue_is_empty(&sa->rtm_held))
+		purple_debug_info("slack", "RTM: handling %u events held during login\n", g_queue_get_length(&sa->rtm_held));
+	while (!g_queue_is_empty(&sa->rtm_held)) {
+		json_value *json = g_queue_pop_head(&sa->rtm_held);
+		if (!rtm_msg(sa, json_get_prop_strptr(json, "type"), json))
+			slack_json_free(json);
+	}
+}
+
+/* Seconds between tickles while not idle */
+#define RTM_TICKLE 60
+/* Seconds to wait for a pong at least (otherwise a few round trips) */
+#define RTM_PING_TIMEOUT 5
+
+static gboolean ping_timer(gpointer data);
+
+static void ping_schedule(SlackAccount *sa, gint64 when, gint64 now) {
+	guint secs = (MAX(when - now, 0) + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC;
+	sa->ping_timer = purple_timeout_add_seconds(MAX(secs, 1), ping_timer, sa);
+}
+
+/* Keepalive: ping only once nothing has been heard for ping_interval seconds, then again each time a reply is overdue,
+ * and declare the connection dead after ping_tries of them go unanswered */
 static gboolean ping_timer(gpointer data) {
 	SlackAccount *sa = data;
+	sa->ping_timer = 0;
+
+	if (!sa->rtm)
+		/* reconnecting: rtm_connect_cb starts us again */
+		return FALSE;
+
+	const PurpleWebsocketStats *stats = purple_websocket_stats(sa->rtm);
+	gint64 now = g_get_monotonic_time();
+	gint64 interval = MAX(purple_account_get_int(sa->account, "ping_interval", 60), 1) * G_USEC_PER_SEC;
+	gint64 timeout = MAX(RTM_PING_TIMEOUT * G_USEC_PER_SEC, 4*stats->srtt);
 
 	PurplePresence *pres = purple_account_get_presence(sa->account);
-	if (pres && purple_presence_get_idle_time(pres) == 0)
+	gboolean active = pres && purple_presence_get_idle_time(pres) == 0;
+	if (active && now - sa->rtm_tickle >= RTM_TICKLE * G_USEC_PER_SEC) {
 		slack_rtm_send(sa, NULL, NULL, "tickle", NULL);
-	else
-		/* we don't care about the response (at this point) so just send a uni-directional PONG */
-		purple_websocket_send(sa->rtm, PURPLE_WEBSOCKET_PONG, NULL, 0);
-	return TRUE;
+		sa->rtm_tickle = now;
+	}
+
+	gint64 next;
+	if (stats->unanswered) {
+		next = stats->ping_sent + timeout;
+		if (next <= now && stats->unanswered >= (guint)MAX(purple_account_get_int(sa->account, "ping_tries", 3), 1)) {
+			purple_debug_warning("slack", "RTM connection timed out: %u pings unanswered\n", stats->unanswered);
+			purple_websocket_abort(sa->rtm);
+			rtm_lost(sa, "RTM connection timed out");
+			return FALSE;
+		}
+	} else
+		next = stats->last_in + interval;
+
+	if (next <= now) {
+		purple_websocket_ping(sa->rtm);
+		next = now + timeout;
+	}
+	if (active)
+		next = MIN(next, sa->rtm_tickle + RTM_TICKLE * G_USEC_PER_SEC);
+
+	ping_schedule(sa, next, now);
+	return FALSE;
 }
 
 static gboolean rtm_connect_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
 	if (error) {
-		purple_connection_error_reason(sa->gc, slack_api_connection_error(error), error);
+		PurpleConnectionError reason = slack_api_connection_error(error);
+		if (sa->rtm_resume && reason == PURPLE_CONNECTION_ERROR_NETWORK_ERROR)
+			rtm_lost(sa, error);
+		else
+			purple_connection_error_reason(sa->gc, reason, error);
 		return FALSE;
 	}
 
@@ -183,21 +542,38 @@ static gboolean rtm_connect_cb(SlackAccount *sa, gpointer data, json_value *json
 
 #undef SET_STR
 
-	/* now that we have team info... */
-	slack_blist_init(sa);
+	if (!sa->rtm_resume) {
+		/* now that we have team info... */
+		slack_blist_init(sa);
 
-	slack_login_step(sa);
+		slack_login_done(sa, SLACK_LOGIN_RTM_CONNECT);
+	}
 
 	gchar *cookie = NULL;
 	if (sa->d_cookie)
 		cookie = g_strconcat("d=", sa->d_cookie, NULL);
 
+	/* what we send is too short to be worth compressing */
+	static const PurpleWebsocketDeflate deflate = { .compress = FALSE };
+
 	purple_debug_info("slack", "RTM URL: %s\n", url);
-	sa->rtm = purple_websocket_connect(sa->account, url, NULL, cookie, rtm_cb, sa);
+	sa->rtm = purple_websocket_connect(sa->account, url, NULL, cookie,
+			purple_account_get_bool(sa->account, "rtm_compress", TRUE) ? &deflate : NULL,
+			rtm_cb, sa);
+	if (sa->rtm)
+		purple_websocket_set_partial(sa->rtm, RTM_PARTIAL);
+	if (sa->rtm_partial) {
+		g_string_free(sa->rtm_partial, TRUE);
+		sa->rtm_partial = NULL;
+	}
+	sa->rtm_discard = FALSE;
 
 	g_free(cookie);
 
-	sa->ping_timer = purple_timeout_add_seconds(60, ping_timer, sa);
+	if (!sa->ping_timer) {
+		sa->rtm_tickle = g_get_monotonic_time();
+		ping_schedule(sa, sa->rtm_tickle + MAX(purple_account_get_int(sa->account, "ping_interval", 60), 1) * G_USEC_PER_SEC, sa->rtm_tickle);
+	}
 	return FALSE;
 }
 
@@ -208,7 +584,12 @@ void slack_rtm_cancel(SlackRTMCall *call) {
 }
 
 void slack_rtm_send(SlackAccount *sa, SlackRTMCallback *callback, gpointer user_data, const char *type, ...) {
-	g_return_if_fail(sa->rtm);
+	if (!sa->rtm) {
+		/* reconnecting */
+		if (callback)
+			callback(sa, user_data, NULL, "Not connected");
+		return;
+	}
 	guint id = ++sa->rtm_id;
 
 	GString *json = g_string_new(NULL);
@@ -239,5 +620,6 @@ void slack_rtm_send(SlackAccount *sa, SlackRTMCallback *callback, gpointer user_
 }
 
 void slack_rtm_connect(SlackAccount *sa) {
-	slack_api_post(sa, rtm_connect_cb, NULL, "rtm.connect", "batch_presence_aware", "1", "presence_sub", "true", NULL);
+	rtm_ignore_init(sa);
+	slack_api_post_priority(sa, SLACK_API_LOGIN, rtm_connect_cb, NULL, "rtm.connect", "batch_presence_aware", "1", "presence_sub", "true", NULL);
 }
@@ -9,8 +9,13 @@ typedef struct _SlackRTMCall SlackRTMCall;
 typedef void SlackRTMCallback(SlackAccount *sa, gpointer user_data, json_value *json, const char *error);
 
 void slack_rtm_connect(SlackAccount *sa);
-/* Send an RTM message of the given type (unquoted, escaped json string) with the given key (unquoted, escaped json string), value (const char *json) pairs */
+/* Handle the events that came in before users and conversations were loaded */
+void slack_rtm_release(SlackAccount *sa);
+/* Send an RTM message of the given type (unquoted, escaped json string) with the given key (unquoted, escaped json string), value (const char *json) pairs.
+ * If the RTM connection is down, the callback gets an error straight away. */
 void slack_rtm_send(SlackAccount *sa, SlackRTMCallback *callback, gpointer user_data, const char *type, /* const char *key1, const char *json1, */ ...) G_GNUC_NULL_TERMINATED;
 void slack_rtm_cancel(SlackRTMCall *call);
+/* Append counts (and handler times, with api_stats) of RTM events received */
+void slack_rtm_stats(SlackAccount *sa, GString *out);
 
 #endif
@@ -32,12 +32,12 @@ SlackUser *slack_user_set(SlackAccount *sa, const char *sid, const char *name) {
 	slack_object_id_set(id, sid);
 	g_warn_if_fail(name);
 
-	SlackUser *user = g_hash_table_lookup(sa->users, id);
+	SlackUser *user = (SlackUser*)slack_object_table_lookup(sa->users, id);
 
 	if (!user) {
 		user = g_object_new(SLACK_TYPE_USER, NULL);
 		slack_object_id_copy(user->object.id, id);
-		g_hash_table_replace(sa->users, user->object.id, user);
+		slack_object_table_replace(sa->users, &user->object);
 	}
 
 	if (g_strcmp0(user->object.name, name)) {
@@ -63,14 +63,14 @@ SlackUser *slack_user_update(SlackAccount *sa, json_value *json) {
 	SlackUser *user;
 
 	if (json_get_prop_boolean(json, "deleted", FALSE)) {
-		user = (SlackUser*)slack_object_hash_table_lookup(sa->users, sid);
+		user = (SlackUser*)slack_object_table_lookup(sa->users, sid);
 		if (!user)
 			return NULL;
 		if (user->object.name)
 			g_hash_table_remove(sa->user_names, user->object.name);
 		if (*user->im)
-			g_hash_table_remove(sa->ims, user->im);
-		slack_object_hash_table_remove(sa->users, sid);
+			slack_object_table_remove(sa->ims, user->im);
+		slack_object_table_remove(sa->users, sid);
 		return NULL;
 	}
 
@@ -107,6 +107,20 @@ void slack_user_changed(SlackAccount *sa, json_value *json) {
 	slack_user_update(sa, json_get_prop(json, "user"));
 }
 
+/* everything slack_user_update looks at */
+static const char *const users_list_fields[] = {
+	SLACK_API_FIELDS,
+	"members.id",
+	"members.name",
+	"members.deleted",
+	"members.profile.display_name",
+	"members.profile.status_text",
+	"members.profile.current_status",
+	"members.profile.avatar_hash",
+	"members.profile.image_192",
+	NULL
+};
+
 static gboolean users_list_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
 	json_value *members = json_get_prop_type(json, "members", array);
 	if (!members) {
@@ -120,22 +134,28 @@ static gboolean users_list_cb(SlackAccount *sa, gpointer data, json_value *json,
 
 	char *cursor = json_get_prop_strptr1(json_get_prop(json, "response_metadata"), "next_cursor");
 	if (cursor)
-		slack_api_post(sa, users_list_cb, NULL, "users.list", "presence", "false", SLACK_PAGINATE_LIMIT_ARG, "cursor", cursor, NULL);
+		slack_api_post_fields(sa, SLACK_API_DIRECTORY(sa), users_list_fields, users_list_cb, NULL, "users.list", "presence", "false", SLACK_PAGINATE_LIMIT_ARG, "cursor", cursor, NULL);
 	else
-		slack_login_step(sa);
+		slack_login_done(sa, SLACK_LOGIN_USERS);
 	return FALSE;
 }
 
 void slack_users_load(SlackAccount *sa) {
 	// g_hash_table_remove_all(sa->users); /* this isn't really necessary, and we'd prefer to preserve self */
-	slack_api_post(sa, users_list_cb, NULL, "users.list", "presence", "false", SLACK_PAGINATE_LIMIT_ARG, NULL);
+	slack_api_post_fields(sa, SLACK_API_DIRECTORY(sa), users_list_fields, users_list_cb, NULL, "users.list", "presence", "false", SLACK_PAGINATE_LIMIT_ARG, NULL);
 }
 
-struct user_retrieve {
+struct user_retrieve_waiter {
 	SlackUserCallback *cb;
 	gpointer data;
 };
 
+/* A pending users.info lookup, in sa->user_lookups */
+struct user_retrieve {
+	slack_object_id id;
+	GSList *waiters; /* struct user_retrieve_waiter, newest first */
+};
+
 static gboolean user_retrieve_cb(SlackAccount *sa, gpointer data, json_value *json, const char *error) {
 	struct user_retrieve *lookup = data;
 	json_value *user = json_get_prop_type(json, "user", object);
@@ -144,26 +164,50 @@ static gboolean user_retrieve_cb(SlackAccount *sa, gpointer data, json_value *js
 		purple_debug_error("slack", "Error retrieving user: %s\n", error ?: "missing");
 	else
 		obj = slack_user_update(sa, user);
-	lookup->cb(sa, lookup->data, obj);
+
+	g_hash_table_remove(sa->user_lookups, lookup->id);
+	GSList *waiters = g_slist_reverse(lookup->waiters);
+	for (GSList *l = waiters; l; l = l->next) {
+		struct user_retrieve_waiter *w = l->data;
+		w->cb(sa, w->data, obj);
+	}
+	g_slist_free_full(waiters, g_free);
 	g_free(lookup);
 	return FALSE;
 }
 
 void slack_user_retrieve(SlackAccount *sa, const char *uid, SlackUserCallback *cb, gpointer data) {
-	SlackUser *user = (SlackUser *)slack_object_hash_table_lookup(sa->users, uid);
+	SlackUser *user = (SlackUser *)slack_object_table_lookup(sa->users, uid);
 	if (user && !uid)
 		return cb(sa, data, user);
-	struct user_retrieve *lookup = g_new(struct user_retrieve, 1);
-	lookup->cb = cb;
-	lookup->data = data;
-	slack_api_post(sa, user_retrieve_cb, lookup, "users.info", "user", uid, NULL);
+
+	struct user_retrieve_waiter *w = g_new(struct user_retrieve_waiter, 1);
+	w->cb = cb;
+	w->data = data;
+
+	/* only one users.info per user at a time: later callers wait on the same response */
+	slack_object_id id;
+	slack_object_id_set(id, uid);
+	struct user_retrieve *lookup = g_hash_table_lookup(sa->user_lookups, id);
+	if (lookup) {
+		sa->lookup_hits++;
+		lookup->waiters = g_slist_prepend(lookup->waiters, w);
+		return;
+	}
+	sa->lookup_misses++;
+
+	lookup = g_new(struct user_retrieve, 1);
+	slack_object_id_copy(lookup->id, id);
+	lookup->waiters = g_slist_prepend(NULL, w);
+	g_hash_table_insert(sa->user_lookups, lookup->id, lookup);
+	slack_api_post_priority(sa, SLACK_API_BACKGROUND, user_retrieve_cb, lookup, "users.info", "user", uid, NULL);
 }
 
 static void presence_set(SlackAccount *sa, json_value *json, const char *presence) {
 	if (json->type != json_string)
 		return;
 	const char *id = json->u.string.ptr;
-	SlackUser *user = (SlackUser*)slack_object_hash_table_lookup(sa->users, id);
+	SlackUser *user = (SlackUser*)slack_object_table_lookup(sa->users, id);
 	if (!user || !user->object.name)
 		return;
 	purple_debug_misc("slack", "setting user %s presence to %s\n", user->object.name, presence);
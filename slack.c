@@ -10,6 +10,7 @@
 #include <version.h>
 
 #include "slack.h"
+#include "slack-http.h"
 #include "slack-api.h"
 #include "slack-auth.h"
 #include "slack-rtm.h"
@@ -21,6 +22,7 @@
 #include "slack-blist.h"
 #include "slack-message.h"
 #include "slack-cmd.h"
+#include "slack-cache.h"
 
 static const char *slack_list_icon(G_GNUC_UNUSED PurpleAccount * account, G_GNUC_UNUSED PurpleBuddy * buddy) {
 	return "slack";
@@ -258,18 +260,26 @@ static void slack_login(PurpleAccount *account) {
 		}
 	}
 
-	g_queue_init(&sa->api_calls);
+	sa->login_start = g_get_monotonic_time();
+	sa->http = slack_http_pool_new(account);
+	for (unsigned p = 0; p < SLACK_API_PRIORITIES; p++)
+		g_queue_init(&sa->api_calls[p]);
+	sa->api_limits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	sa->api_stats = purple_account_get_bool(account, "api_stats", FALSE);
 
 	sa->rtm_call = g_hash_table_new_full(g_direct_hash,        g_direct_equal,        NULL, (GDestroyNotify)slack_rtm_cancel);
 
-	sa->users    = g_hash_table_new_full(slack_object_id_hash, slack_object_id_equal, NULL, g_object_unref);
+	sa->users    = slack_object_table_new(G_STRUCT_OFFSET(SlackObject, id), TRUE);
 	sa->user_names = g_hash_table_new_full(g_str_hash,         g_str_equal,           NULL, NULL);
-	sa->ims      = g_hash_table_new_full(slack_object_id_hash, slack_object_id_equal, NULL, NULL);
+	sa->ims      = slack_object_table_new(G_STRUCT_OFFSET(SlackUser, im), FALSE);
 
-	sa->channels = g_hash_table_new_full(slack_object_id_hash, slack_object_id_equal, NULL, g_object_unref);
+	sa->channels = slack_object_table_new(G_STRUCT_OFFSET(SlackObject, id), TRUE);
 	sa->channel_names = g_hash_table_new_full(g_str_hash,      g_str_equal,           NULL, NULL);
 	sa->channel_cids = g_hash_table_new_full(g_direct_hash,    g_direct_equal,        NULL, NULL);
 
+	sa->user_lookups = g_hash_table_new(slack_object_id_hash, slack_object_id_equal);
+	sa->conversation_lookups = g_hash_table_new(slack_object_id_hash, slack_object_id_equal);
+
 	g_queue_init(&sa->avatar_queue);
 
 	sa->buddies = g_hash_table_new_full(/* slack_object_id_hash, slack_object_id_equal, */ g_str_hash, g_str_equal, NULL, NULL);
@@ -306,7 +316,7 @@ static void slack_login(PurpleAccount *account) {
 		g_strfreev(tokens);
 
 		/* set the api url to the property host */
-		sa->api_url = g_strdup_printf("https://%s/api", sa->host);
+		slack_set_api_url(sa, sa->host);
 
 		/* finally skip the mobile login as we already have a token */
 		sa->login_step = 3;
@@ -327,16 +337,56 @@ static void slack_login(PurpleAccount *account) {
 		 * end of authentication.
 		 */
 		sa->token = g_strdup("");
-		sa->api_url = g_strdup_printf("https://slack.com/api");
+		slack_set_api_url(sa, "slack.com");
 	}
 
 	slack_login_step(sa);
 }
 
+/* authentication steps, then one for each SlackLoginStage */
+#define LOGIN_STEPS (4 + SLACK_LOGIN_STAGES)
+
+static const char *const login_stage_names[SLACK_LOGIN_STAGES] = {
+	[SLACK_LOGIN_RTM_CONNECT]	= "Requested RTM",
+	[SLACK_LOGIN_RTM]		= "RTM connected",
+	[SLACK_LOGIN_USERS]		= "Loaded users",
+	[SLACK_LOGIN_CONVERSATIONS]	= "Loaded conversations",
+	[SLACK_LOGIN_COUNTS]		= "Loaded active conversations",
+};
+
+static void login_start(SlackAccount *sa, SlackLoginStage stage) {
+	sa->login_stage_start[stage] = g_get_monotonic_time();
+	switch (stage) {
+		case SLACK_LOGIN_RTM_CONNECT:
+			slack_rtm_connect(sa);
+			break;
+		case SLACK_LOGIN_USERS:
+			slack_users_load(sa);
+			break;
+		case SLACK_LOGIN_CONVERSATIONS:
+			slack_conversations_load(sa);
+			break;
+		case SLACK_LOGIN_COUNTS:
+			slack_conversation_counts(sa);
+			break;
+		default:
+			/* started by another stage */
+			break;
+	}
+}
+
+void slack_set_api_url(SlackAccount *sa, const char *host) {
+	const char *url = purple_account_get_string(sa->account, "api_url", NULL);
+	g_free(sa->api_url);
+	sa->api_url = url && *url ? g_strdup(url) : g_strdup_printf("https://%s/api", host);
+}
+
 void slack_login_step(SlackAccount *sa) {
-	gboolean lazy = FALSE;
-#define MSG(msg) \
-	purple_connection_update_progress(sa->gc, msg, ++sa->login_step, 10)
+#define MSG(msg) do { \
+	purple_connection_update_progress(sa->gc, msg, ++sa->login_step, LOGIN_STEPS); \
+	purple_debug_misc("slack", "login: %s at %.3fs, %u API calls\n", msg, \
+			(g_get_monotonic_time() - sa->login_start) / (double)G_USEC_PER_SEC, sa->api_count); \
+} while (0)
 	switch (sa->login_step) {
 		case 0:
 			MSG("Looking up team");
@@ -349,38 +399,63 @@ void slack_login_step(SlackAccount *sa) {
 			MSG("Logging in");
 			break;
 		case 3:
-			MSG("Requesting RTM");
-			slack_rtm_connect(sa);
+			MSG("Connecting");
+			slack_cache_load(sa);
+			/* none of these depend on each other (conversations are only applied once users are in) */
+			login_start(sa, SLACK_LOGIN_RTM_CONNECT);
+			if (purple_account_get_bool(sa->account, "lazy_load", FALSE)) {
+				/* nothing to wait for */
+				sa->login_done |= 1 << SLACK_LOGIN_USERS | 1 << SLACK_LOGIN_CONVERSATIONS;
+			} else {
+				login_start(sa, SLACK_LOGIN_USERS);
+				login_start(sa, SLACK_LOGIN_CONVERSATIONS);
+			}
 			break;
-		case 4: /* slack_connect_cb */
-			MSG("Connecting to RTM");
-			/* purple_websocket_connect */
+	}
+#undef MSG
+}
+
+void slack_login_done(SlackAccount *sa, SlackLoginStage stage) {
+	g_return_if_fail(!slack_login_is_done(sa, stage));
+	sa->login_done |= 1 << stage;
+
+	gint64 now = g_get_monotonic_time();
+	purple_connection_update_progress(sa->gc, login_stage_names[stage], ++sa->login_step, LOGIN_STEPS);
+	purple_debug_misc("slack", "login: %s in %.3fs, at %.3fs, %u API calls\n", login_stage_names[stage],
+			(now - sa->login_stage_start[stage]) / (double)G_USEC_PER_SEC,
+			(now - sa->login_start) / (double)G_USEC_PER_SEC, sa->api_count);
+
+	switch (stage) {
+		case SLACK_LOGIN_RTM_CONNECT:
+			/* rtm_connect_cb goes on to open the websocket */
+			sa->login_stage_start[SLACK_LOGIN_RTM] = now;
+			/* fall through: the buddy list is ready */
+		case SLACK_LOGIN_USERS:
+			slack_conversations_flush(sa);
 			break;
-		case 5: /* rtm_cb */
-			MSG("RTM Connected");
+		case SLACK_LOGIN_CONVERSATIONS:
+			slack_cache_revalidated(sa);
+			slack_rtm_release(sa);
 			break;
-		case 6: /* rtm_msg("hello") */
-			lazy = purple_account_get_bool(sa->account, "lazy_load", FALSE);
-			MSG("Loading Users");
-			if (!lazy) {
-				slack_users_load(sa);
-				break;
-			}
-		case 7:
-			MSG("Loading conversations");
-			if (!lazy) {
-				slack_conversations_load(sa);
-				break;
-			}
-		case 8:
-			MSG("Loading active conversations");
-			slack_conversation_counts(sa);
+		default:
 			break;
-		case 9:
-			slack_presence_sub(sa);
-			purple_connection_set_state(sa->gc, PURPLE_CONNECTED);
 	}
-#undef MSG
+
+	if (!sa->login_stage_start[SLACK_LOGIN_COUNTS] &&
+			slack_login_directory_ready(sa) && slack_login_is_done(sa, SLACK_LOGIN_RTM_CONNECT))
+		login_start(sa, SLACK_LOGIN_COUNTS);
+
+	/* with a snapshot, users and conversations can finish after we're connected */
+	guint need = (1 << SLACK_LOGIN_STAGES) - 1;
+	if (sa->login_cached)
+		need &= ~(1 << SLACK_LOGIN_USERS | 1 << SLACK_LOGIN_CONVERSATIONS);
+	if ((sa->login_done & need) != need || purple_connection_get_state(sa->gc) == PURPLE_CONNECTED)
+		return;
+	slack_presence_sub(sa);
+	purple_connection_set_state(sa->gc, PURPLE_CONNECTED);
+	slack_marks_load(sa);
+	purple_debug_info("slack", "connected in %.3fs, %u API calls\n",
+			(g_get_monotonic_time() - sa->login_start) / (double)G_USEC_PER_SEC, sa->api_count);
 }
 
 static void slack_close(PurpleConnection *gc) {
@@ -388,35 +463,58 @@ static void slack_close(PurpleConnection *gc) {
 
 	if (!sa)
 		return;
+	sa->closing = TRUE;
 
-	if (sa->mark_timer) {
-		/* really should send final marks if we can... */
-		purple_timeout_remove(sa->mark_timer);
-		sa->mark_timer = 0;
-	}
+	/* no time to send final marks, so keep them for next time */
+	slack_marks_save(sa);
+	slack_cache_save(sa);
 
 	if (sa->ping_timer) {
 		purple_timeout_remove(sa->ping_timer);
 		sa->ping_timer = 0;
 	}
+	if (sa->rtm_resume_timer) {
+		purple_timeout_remove(sa->rtm_resume_timer);
+		sa->rtm_resume_timer = 0;
+	}
+	sa->rtm_resume = 0;
+
+	/* before the RTM state goes, as failing calls (like a resuming rtm.connect) may still use it */
+	slack_api_disconnect(sa);
 
 	if (sa->rtm) {
 		purple_websocket_abort(sa->rtm);
 		sa->rtm = NULL;
 	}
 	g_hash_table_destroy(sa->rtm_call);
-
-	slack_api_disconnect(sa);
+	g_free(sa->rtm_stats);
+	if (sa->rtm_ignore)
+		g_hash_table_destroy(sa->rtm_ignore);
+	if (sa->rtm_partial)
+		g_string_free(sa->rtm_partial, TRUE);
+	while (!g_queue_is_empty(&sa->rtm_held))
+		slack_json_free(g_queue_pop_head(&sa->rtm_held));
+	while (!g_queue_is_empty(&sa->login_conversations))
+		slack_json_free(g_queue_pop_head(&sa->login_conversations));
+	if (sa->cache_stale)
+		g_hash_table_destroy(sa->cache_stale);
+
+	/* pending lookups have all been failed (and freed) by now */
+	g_hash_table_destroy(sa->conversation_lookups);
+	g_hash_table_destroy(sa->user_lookups);
+	purple_debug_info("slack", "info lookups: %u sent, %u shared\n", sa->lookup_misses, sa->lookup_hits);
+	g_hash_table_destroy(sa->api_limits);
+	slack_http_pool_free(sa->http);
 
 	g_hash_table_destroy(sa->buddies);
 
 	g_hash_table_destroy(sa->channel_cids);
 	g_hash_table_destroy(sa->channel_names);
-	g_hash_table_destroy(sa->channels);
+	slack_object_table_free(sa->channels);
 
-	g_hash_table_destroy(sa->ims);
+	slack_object_table_free(sa->ims);
 	g_hash_table_destroy(sa->user_names);
-	g_hash_table_destroy(sa->users);
+	slack_object_table_free(sa->users);
 
 #if GLIB_CHECK_VERSION(2,60,0)
 	g_queue_clear_full(&sa->avatar_queue, g_object_unref);
@@ -606,6 +704,9 @@ static void init_plugin(G_GNUC_UNUSED PurplePlugin *plugin)
 	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
 		purple_account_option_bool_new("Show members in channels (disabling may break channel features)", "channel_members", TRUE));
 
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_string_new("RTM events to ignore (space separated)", "ignore_rtm_events", ""));
+
 	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
 		purple_account_option_string_new("Prepend attachment lines with this string", "attachment_prefix", "▎ "));
 
@@ -617,6 +718,24 @@ static void init_plugin(G_GNUC_UNUSED PurplePlugin *plugin)
 
 	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
 		purple_account_option_int_new("Seconds to delay when ratelimited", "ratelimit_delay", 15));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_int_new("Maximum concurrent API requests", "api_concurrency", 4));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_bool_new("Collect API statistics (see /slackstats)", "api_stats", FALSE));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_bool_new("Compress RTM connection", "rtm_compress", TRUE));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_int_new("Seconds of RTM silence before pinging", "ping_interval", 60));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_int_new("Unanswered pings before reconnecting", "ping_tries", 3));
+
+	prpl_info.protocol_options = g_list_append(prpl_info.protocol_options,
+		purple_account_option_bool_new("Cache users and channels between sessions", "directory_cache", TRUE));
 }
 
 PURPLE_INIT_PLUGIN(slack, init_plugin, info);
@@ -13,9 +13,30 @@
 
 #define MARK_LIST_END ((SlackObject *)1)
 
+/* API calls are queued in lanes, and started in this order */
+typedef enum {
+	SLACK_API_INTERACTIVE = 0, /* things the user is waiting on */
+	SLACK_API_LOGIN, /* needed to finish connecting */
+	SLACK_API_BACKGROUND, /* lookups and other prefetching */
+	SLACK_API_BULK, /* history and other large fetches */
+	SLACK_API_PRIORITIES
+} SlackAPIPriority;
+
+/* What has to happen after authentication to finish logging in.
+ * Each starts as soon as what it needs is done, so independent ones run concurrently (see slack_login_done). */
+typedef enum {
+	SLACK_LOGIN_RTM_CONNECT = 0, /* rtm.connect: team info (for the buddy list) and websocket url */
+	SLACK_LOGIN_RTM, /* websocket open and hello received */
+	SLACK_LOGIN_USERS, /* users.list */
+	SLACK_LOGIN_CONVERSATIONS, /* conversations.list (applied once users and the buddy list are ready) */
+	SLACK_LOGIN_COUNTS, /* users.counts, once conversations are in */
+	SLACK_LOGIN_STAGES
+} SlackLoginStage;
+
 typedef struct _SlackAccount {
 	PurpleAccount *account;
 	PurpleConnection *gc;
+	gboolean closing; /* in slack_close: nothing more should be started */
 	char *email;
 	char *host;
 	char *api_url; /* e.g., "https://slack.com/api" */
@@ -23,11 +44,33 @@ typedef struct _SlackAccount {
 	char *d_cookie;
 
 	short login_step;
-	GQueue api_calls; /* SlackAPICall */
+	gint64 login_start; /* monotonic time slack_login started, for reporting */
+	guint login_done; /* 1 << SlackLoginStage of those finished */
+	gint64 login_stage_start[SLACK_LOGIN_STAGES]; /* monotonic time each started, for reporting */
+	GQueue login_conversations; /* conversations.list pages (json_value *) waiting on users and the buddy list, then NULL when that's all */
+	gboolean login_cached; /* users and conversations came from the snapshot (slack-cache.c), so their lists are only revalidating it */
+	GHashTable *cache_stale; /* char *id: channels and IMs from the snapshot not (yet) in conversations.list */
+	struct _SlackHTTPPool *http; /* persistent API connections */
+	GQueue api_calls[SLACK_API_PRIORITIES]; /* SlackAPICall, by priority */
+	guint api_running; /* number of api_calls currently being fetched */
+	guint api_count; /* number of api calls sent */
+	GHashTable *api_limits; /* char *endpoint -> rate limit state and statistics */
+	guint api_timer; /* waiting for rate limits */
+	gboolean api_stats; /* collect api statistics */
+	guint api_stats_timer; /* periodic statistics dump */
 	PurpleWebsocket *rtm;
 	guint rtm_id;
 	GHashTable *rtm_call; /* unsigned rtm_id -> SlackRTMCall */
 	guint ping_timer;
+	struct rtm_event_stats *rtm_stats; /* per RTM event type (slack-rtm.c) */
+	GHashTable *rtm_ignore; /* char *type: RTM events to drop without parsing */
+	GString *rtm_partial; /* pieces so far of a long RTM message */
+	gboolean rtm_discard; /* dropping the rest of a long RTM message */
+	guint rtm_resume; /* reconnect attempts since the RTM connection was lost, or 0 if not */
+	guint rtm_resume_timer;
+	gint64 rtm_lost; /* when */
+	gint64 rtm_tickle; /* when we last sent a tickle */
+	GQueue rtm_held; /* RTM events (json_value *) received before users and conversations were loaded (see rtm_hold) */
 
 	struct _SlackTeam {
 		char *id;
@@ -36,21 +79,26 @@ typedef struct _SlackAccount {
 	} team;
 	struct _SlackUser *self;
 
-	GHashTable *users; /* slack_object_id user_id -> SlackUser (ref) */
+	SlackObjectTable *users; /* slack_object_id user_id -> SlackUser (ref) */
 	GHashTable *user_names; /* char *user_name -> SlackUser (no ref) */
-	GHashTable *ims; /* slack_object_id im_id -> SlackUser (no ref) */
+	SlackObjectTable *ims; /* slack_object_id im_id -> SlackUser (no ref) */
 
-	GHashTable *channels; /* slack_object_id channel_id -> SlackChannel (ref) */
+	SlackObjectTable *channels; /* slack_object_id channel_id -> SlackChannel (ref) */
 	GHashTable *channel_names; /* char *chan_name -> SlackChannel (no ref) */
 	int cid;
 	GHashTable *channel_cids; /* int purple_chat_id -> SlackChannel (no ref) */
 
+	GHashTable *user_lookups; /* slack_object_id user_id -> pending users.info lookup */
+	GHashTable *conversation_lookups; /* slack_object_id conversation_id -> pending conversations.info lookup */
+	guint lookup_hits, lookup_misses; /* retrieves that joined a pending lookup, or had to start one */
+
 	PurpleGroup *blist; /* default group for ims/channels */
 	GHashTable *buddies; /* char *slack_id -> PurpleBListNode */
 	gboolean roomlist_stop;
 
 	guint mark_timer;
-	SlackObject *mark_list;
+	SlackObject *mark_list; /* pending marks, linked by mark_next */
+	SlackObject *mark_sending; /* conversations.mark in flight (ref) */
 
 	GQueue avatar_queue; /* SlackUser * queue for avatar downloads */
 
@@ -58,6 +106,19 @@ typedef struct _SlackAccount {
 } SlackAccount;
 
 void slack_login_step(SlackAccount *sa);
+/* Set sa->api_url for host, unless the (hidden) api_url setting points somewhere else, like the mock server in bench/ */
+void slack_set_api_url(SlackAccount *sa, const char *host);
+/* Called when a SlackLoginStage has finished, to start whatever was waiting on it */
+void slack_login_done(SlackAccount *sa, SlackLoginStage stage);
+static inline gboolean slack_login_is_done(SlackAccount *sa, SlackLoginStage stage) {
+	return sa->login_done & 1 << stage;
+}
+/* Are users and conversations loaded enough to use? */
+static inline gboolean slack_login_directory_ready(SlackAccount *sa) {
+	return sa->login_cached || slack_login_is_done(sa, SLACK_LOGIN_CONVERSATIONS);
+}
+/* users.list and conversations.list only need to hurry without a snapshot */
+#define SLACK_API_DIRECTORY(sa) ((sa)->login_cached ? SLACK_API_BACKGROUND : SLACK_API_LOGIN)
 GHashTable *slack_chat_info_defaults(PurpleConnection *gc, const char *name);
 
 static inline SlackAccount *get_slack_account(PurpleAccount *account) {